@@ -28,6 +28,7 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
@@ -36,8 +37,34 @@
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * Locking:
+ *
+ * binder_main_lock is taken for reading by every ioctl, poll and deferred
+ * flush, and for writing only where procs, threads or node->proc change
+ * (BINDER_THREAD_EXIT, BINDER_SET_CONTEXT_MGR, deferred put_files and
+ * release) and by the debugfs dumps.  Holding it for reading therefore
+ * keeps every binder_proc, binder_thread and node->proc stable.
+ *
+ * Everything else is per process and nests in this order:
+ *   proc->outer_lock  refs_by_desc, refs_by_node and the refs in them
+ *   proc->inner_lock  threads, nodes (including node->refs), todo lists,
+ *                     transaction stacks, return errors, looper state,
+ *                     delivered_death and thread pool accounting, and the
+ *                     t->buffer <-> buffer->transaction link of buffers
+ *                     in this proc
+ *   proc->alloc_lock  the buffer area of this proc
+ *
+ * Two outer locks are only held together by binder_transaction(), in
+ * address order (binder_lock_refs()).  No path holds two inner locks.
+ * Nodes of dead procs are protected by binder_dead_nodes_lock in place of
+ * the inner lock of their proc, see binder_node_mutex().
+ */
+static DECLARE_RWSEM(binder_main_lock);
+static DEFINE_MUTEX(binder_procs_lock);
+static DEFINE_MUTEX(binder_dead_nodes_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -47,7 +74,7 @@ static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -105,6 +132,17 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/*
+ * Pages of freed buffers each proc keeps mapped for reuse.  A proc that
+ * receives larger buffers may keep up to large_cache_pages, until memory
+ * pressure shrinks it back.
+ */
+static int binder_cache_pages = 32;
+module_param_named(cache_pages, binder_cache_pages, int, S_IWUSR | S_IRUGO);
+static int binder_large_cache_pages = 256;
+module_param_named(large_cache_pages, binder_large_cache_pages, int,
+		   S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -146,22 +184,22 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -188,6 +226,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -195,6 +234,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -210,6 +250,19 @@ struct binder_work {
 	} type;
 };
 
+/*
+ * Latency of two-way transactions, from the call to the reply, bucketed by
+ * powers of two: bucket i counts latencies below 2^i us.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+struct binder_latency_hist {
+	unsigned long count;
+	u64 total_us;
+	u64 max_us;
+	unsigned long buckets[BINDER_LATENCY_BUCKETS];
+};
+
 struct binder_node {
 	int debug_id;
 	struct binder_work work;
@@ -232,6 +285,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_latency_hist *latency;
 };
 
 struct binder_ref_death {
@@ -273,6 +327,24 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+/* allocation size classes: below 256 bytes, 1K, 4K, ... 256K, larger */
+#define BINDER_ALLOC_SIZE_CLASSES 7
+
+struct binder_alloc_stats {
+	unsigned long allocs;
+	unsigned long alloc_failures;
+	u64 alloc_time_ns;
+	u64 max_alloc_time_ns;
+	unsigned long size_classes[BINDER_ALLOC_SIZE_CLASSES];
+	unsigned long pages_allocated;
+	unsigned long pages_reused;
+	unsigned long pages_freed;
+	size_t allocated;
+	size_t max_allocated;
+	int pages_mapped;
+	int max_pages_mapped;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -281,6 +353,9 @@ enum binder_deferred_state {
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex outer_lock;
+	struct mutex inner_lock;
+	struct mutex alloc_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -300,6 +375,10 @@ struct binder_proc {
 	size_t free_async_space;
 
 	struct page **pages;
+	int pages_cached;
+	int cache_limit;
+	struct binder_alloc_stats alloc_stats;
+	struct binder_latency_hist latency;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -355,11 +434,45 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
 };
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+static void binder_lock_refs(struct binder_proc *a, struct binder_proc *b)
+{
+	if (a == b) {
+		mutex_lock(&a->outer_lock);
+		return;
+	}
+	if (a > b)
+		swap(a, b);
+	mutex_lock(&a->outer_lock);
+	mutex_lock_nested(&b->outer_lock, SINGLE_DEPTH_NESTING);
+}
+
+static void binder_unlock_refs(struct binder_proc *a, struct binder_proc *b)
+{
+	if (a != b)
+		mutex_unlock(&b->outer_lock);
+	mutex_unlock(&a->outer_lock);
+}
+
+/*
+ * The state of a node is protected by the inner lock of the proc that owns
+ * it, or by binder_dead_nodes_lock once that proc is gone.  node->proc only
+ * changes with binder_main_lock held for writing.  The lock is looked up
+ * before it is taken since binder_dec_node() may free the node.
+ */
+static struct mutex *binder_node_mutex(struct binder_node *node)
+{
+	return node->proc ? &node->proc->inner_lock : &binder_dead_nodes_lock;
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -607,74 +720,154 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
-static int binder_update_page_range(struct binder_proc *proc, int allocate,
-				    void *start, void *end,
-				    struct vm_area_struct *vma)
+/*
+ * Pages of a freed range stay mapped, up to binder_cache_pages per proc,
+ * so that the next buffer placed over them does not have to allocate and
+ * map them again.  The remaining pages are unmapped in one go.
+ *
+ * Caller holds proc->alloc_lock.
+ */
+static void binder_free_page_range(struct binder_proc *proc,
+				   void *start, void *end)
 {
 	void *page_addr;
-	unsigned long user_page_addr;
-	struct vm_struct tmp_area;
+	void *free_start;
 	struct page **page;
 	struct mm_struct *mm;
+	struct vm_area_struct *vma = NULL;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-		     "binder: %d: %s pages %p-%p\n", proc->pid,
-		     allocate ? "allocate" : "free", start, end);
-
-	if (end <= start)
-		return 0;
-
-	if (vma)
-		mm = NULL;
-	else
-		mm = get_task_mm(proc->tsk);
+		     "binder: %d: free pages %p-%p\n", proc->pid, start, end);
+
+	for (free_start = start;
+	     free_start < end &&
+	     proc->pages_cached < max(binder_cache_pages, proc->cache_limit);
+	     free_start += PAGE_SIZE) {
+		BUG_ON(!proc->pages[(free_start - proc->buffer) / PAGE_SIZE]);
+		proc->pages_cached++;
+	}
+	if (free_start >= end)
+		return;
 
+	mm = get_task_mm(proc->tsk);
 	if (mm) {
 		down_write(&mm->mmap_sem);
 		vma = proc->vma;
 	}
+	if (vma)
+		zap_page_range(vma, (uintptr_t)free_start +
+			       proc->user_buffer_offset, end - free_start, NULL);
+	unmap_kernel_range((unsigned long)free_start, end - free_start);
+	for (page_addr = free_start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		__free_page(*page);
+		*page = NULL;
+		proc->alloc_stats.pages_mapped--;
+		proc->alloc_stats.pages_freed++;
+	}
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+}
 
-	if (allocate == 0)
-		goto free_range;
+/*
+ * Make sure every page in start-end is mapped, reusing cached pages and
+ * allocating and mapping each run of missing pages as a batch.  vma is
+ * only passed in by binder_mmap(), which already holds mmap_sem.
+ *
+ * Caller holds proc->alloc_lock.
+ */
+static int binder_alloc_page_range(struct binder_proc *proc,
+				   void *start, void *end,
+				   struct vm_area_struct *vma)
+{
+	void *page_addr;
+	void *run_start = start;
+	void *run_addr;
+	unsigned long user_page_addr;
+	struct vm_struct tmp_area;
+	struct page **page;
+	struct page **page_array_ptr;
+	struct mm_struct *mm = NULL;
+	int ret;
 
-	if (vma == NULL) {
-		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
-		       "map pages in userspace, no vma\n", proc->pid);
-		goto err_no_vma;
-	}
+	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: allocate pages %p-%p\n", proc->pid,
+		     start, end);
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
+	page_addr = start;
+	while (page_addr < end) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (*page) {
+			BUG_ON(!proc->pages_cached);
+			proc->pages_cached--;
+			proc->alloc_stats.pages_reused++;
+			page_addr += PAGE_SIZE;
+			continue;
+		}
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+		if (vma == NULL) {
+			mm = get_task_mm(proc->tsk);
+			if (mm) {
+				down_write(&mm->mmap_sem);
+				vma = proc->vma;
+			}
+			if (vma == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed to map pages in userspace, "
+				       "no vma\n", proc->pid);
+				run_start = page_addr;
+				goto err_no_vma;
+			}
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
+
+		run_start = page_addr;
 		page_array_ptr = page;
+		for (; page_addr < end && *page == NULL;
+		     page_addr += PAGE_SIZE, page++) {
+			*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+			if (*page == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed for page at %p\n",
+				       proc->pid, page_addr);
+				goto err_alloc_page_failed;
+			}
+		}
+
+		tmp_area.addr = run_start;
+		tmp_area.size = page_addr - run_start + PAGE_SIZE /* guard page? */;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
+			       "to map pages at %p in kernel\n",
+			       proc->pid, run_start);
 			goto err_map_kernel_failed;
 		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
+		for (run_addr = run_start; run_addr < page_addr;
+		     run_addr += PAGE_SIZE) {
+			user_page_addr =
+				(uintptr_t)run_addr + proc->user_buffer_offset;
+			ret = vm_insert_page(vma, user_page_addr,
+				proc->pages[(run_addr - proc->buffer) /
+					    PAGE_SIZE]);
+			if (ret) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed to map page at %lx in "
+				       "userspace\n", proc->pid,
+				       user_page_addr);
+				goto err_vm_insert_page_failed;
+			}
+			/* vm_insert_page does not seem to increment the refcount */
 		}
-		/* vm_insert_page does not seem to increment the refcount */
+		proc->alloc_stats.pages_allocated +=
+			(page_addr - run_start) / PAGE_SIZE;
+		proc->alloc_stats.pages_mapped +=
+			(page_addr - run_start) / PAGE_SIZE;
+		if (proc->alloc_stats.pages_mapped >
+		    proc->alloc_stats.max_pages_mapped)
+			proc->alloc_stats.max_pages_mapped =
+				proc->alloc_stats.pages_mapped;
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -682,32 +875,44 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	zap_page_range(vma, (uintptr_t)run_start + proc->user_buffer_offset,
+		       run_addr - run_start, NULL);
+	unmap_kernel_range((unsigned long)run_start, page_addr - run_start);
 err_map_kernel_failed:
+err_alloc_page_failed:
+	for (run_addr = run_start; run_addr < page_addr; run_addr += PAGE_SIZE) {
+		page = &proc->pages[(run_addr - proc->buffer) / PAGE_SIZE];
 		__free_page(*page);
 		*page = NULL;
-err_alloc_page_failed:
-		;
 	}
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
+	/* hand back what was already set up for this range */
+	if (run_start > start)
+		binder_free_page_range(proc, start, run_start);
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static int binder_alloc_size_class(size_t size)
+{
+	int class = 0;
+
+	size >>= 8;
+	while (size && class < BINDER_ALLOC_SIZE_CLASSES - 1) {
+		size >>= 2;
+		class++;
+	}
+	return class;
+}
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -781,7 +986,17 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
 		end_page_addr = has_page_addr;
-	if (binder_update_page_range(proc, 1,
+	/* let the cache grow so the next buffer this size maps no pages */
+	if (end_page_addr > (void *)PAGE_ALIGN((uintptr_t)buffer->data)) {
+		int pages = (end_page_addr -
+			     (void *)PAGE_ALIGN((uintptr_t)buffer->data)) /
+			    PAGE_SIZE;
+
+		if (pages > proc->cache_limit)
+			proc->cache_limit = min(pages,
+						binder_large_cache_pages);
+	}
+	if (binder_alloc_page_range(proc,
 	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
 		return NULL;
 
@@ -800,6 +1015,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -808,6 +1024,37 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
+	proc->alloc_stats.size_classes[binder_alloc_size_class(size)]++;
+	proc->alloc_stats.allocated += binder_buffer_size(proc, buffer) +
+		sizeof(struct binder_buffer);
+	if (proc->alloc_stats.allocated > proc->alloc_stats.max_allocated)
+		proc->alloc_stats.max_allocated = proc->alloc_stats.allocated;
+
+	return buffer;
+}
+
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+	ktime_t start;
+	u64 ns;
+
+	mutex_lock(&proc->alloc_lock);
+	start = ktime_get();
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	trace_binder_alloc_buf(proc, data_size, offsets_size, is_async,
+			       buffer == NULL, ns);
+	if (buffer) {
+		proc->alloc_stats.allocs++;
+		proc->alloc_stats.alloc_time_ns += ns;
+		if (ns > proc->alloc_stats.max_alloc_time_ns)
+			proc->alloc_stats.max_alloc_time_ns = ns;
+	} else
+		proc->alloc_stats.alloc_failures++;
+	mutex_unlock(&proc->alloc_lock);
 	return buffer;
 }
 
@@ -861,15 +1108,15 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 			     "not share page%s%s with with %p or %p\n",
 			     proc->pid, buffer, free_page_start ? "" : " end",
 			     free_page_end ? "" : " start", prev, next);
-		binder_update_page_range(proc, 0, free_page_start ?
+		binder_free_page_range(proc, free_page_start ?
 			buffer_start_page(buffer) : buffer_end_page(buffer),
 			(free_page_end ? buffer_end_page(buffer) :
-			buffer_start_page(buffer)) + PAGE_SIZE, NULL);
+			buffer_start_page(buffer)) + PAGE_SIZE);
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -897,10 +1144,11 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
-	binder_update_page_range(proc, 0,
+	proc->alloc_stats.allocated -= buffer_size +
+		sizeof(struct binder_buffer);
+	binder_free_page_range(proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK));
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
 	buffer->free = 1;
 	if (!list_is_last(&buffer->entry, &proc->buffers)) {
@@ -923,6 +1171,145 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
+/*
+ * The shrinker's reference on a task's mm may turn out to be the last one
+ * if the task exits meanwhile, and the final mmput() runs exit_mmap(),
+ * which must not happen from inside reclaim.  So the shrinker always drops
+ * it from the binder workqueue.
+ */
+struct binder_mmput_work {
+	struct work_struct work;
+	struct mm_struct *mm;
+};
+
+static void binder_mmput_work_func(struct work_struct *work)
+{
+	struct binder_mmput_work *w =
+		container_of(work, struct binder_mmput_work, work);
+
+	mmput(w->mm);
+	kfree(w);
+}
+
+static void binder_mmput_async(struct binder_mmput_work *w,
+			       struct mm_struct *mm)
+{
+	w->mm = mm;
+	INIT_WORK(&w->work, binder_mmput_work_func);
+	queue_work(binder_deferred_workqueue, &w->work);
+}
+
+/*
+ * Cached pages are exactly the mapped pages inside free buffers.  Free up
+ * to nr_to_scan of them and drop the cache back to its default size.
+ * Called from reclaim, so nothing here may wait on binder or mm locks.
+ *
+ * Caller holds proc->alloc_lock.
+ */
+static int binder_shrink_proc_cache(struct binder_proc *proc, int nr_to_scan)
+{
+	struct rb_node *n;
+	struct mm_struct *mm;
+	struct binder_mmput_work *mmput_work;
+	struct vm_area_struct *vma = NULL;
+	struct page **page;
+	void *page_addr;
+	void *end;
+	int freed = 0;
+
+	if (proc->tsk->flags & PF_EXITING)
+		return 0;
+
+	/* Without the work item the mm could not be released, so don't pin it */
+	mmput_work = kmalloc(sizeof(*mmput_work), GFP_NOWAIT | __GFP_NOWARN);
+	if (!mmput_work)
+		return 0;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm) {
+		if (!down_write_trylock(&mm->mmap_sem)) {
+			binder_mmput_async(mmput_work, mm);
+			return 0;
+		}
+		vma = proc->vma;
+	} else {
+		kfree(mmput_work);
+	}
+
+	for (n = rb_first(&proc->free_buffers);
+	     n != NULL && freed < nr_to_scan && proc->pages_cached;
+	     n = rb_next(n)) {
+		struct binder_buffer *buffer = rb_entry(n,
+				struct binder_buffer, rb_node);
+
+		page_addr = (void *)PAGE_ALIGN((uintptr_t)buffer->data);
+		end = (void *)(((uintptr_t)buffer->data +
+				binder_buffer_size(proc, buffer)) & PAGE_MASK);
+		for (; page_addr < end && freed < nr_to_scan;
+		     page_addr += PAGE_SIZE) {
+			page = &proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE];
+			if (*page == NULL)
+				continue;
+			if (vma)
+				zap_page_range(vma, (uintptr_t)page_addr +
+					proc->user_buffer_offset, PAGE_SIZE,
+					NULL);
+			unmap_kernel_range((unsigned long)page_addr,
+					   PAGE_SIZE);
+			__free_page(*page);
+			*page = NULL;
+			proc->pages_cached--;
+			proc->alloc_stats.pages_mapped--;
+			proc->alloc_stats.pages_freed++;
+			freed++;
+		}
+	}
+	proc->cache_limit = 0;
+
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		binder_mmput_async(mmput_work, mm);
+	}
+	return freed;
+}
+
+static int binder_shrink_cache(struct shrinker *shrinker, int nr_to_scan,
+			       gfp_t gfp_mask)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int cached = 0;
+
+	if (!mutex_trylock(&binder_procs_lock))
+		return nr_to_scan ? -1 : 0;
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (nr_to_scan > 0 && proc->pages_cached &&
+		    mutex_trylock(&proc->alloc_lock)) {
+			nr_to_scan -= binder_shrink_proc_cache(proc,
+							       nr_to_scan);
+			mutex_unlock(&proc->alloc_lock);
+		}
+		cached += proc->pages_cached;
+	}
+	mutex_unlock(&binder_procs_lock);
+	return cached;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink_cache,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/* Caller holds proc->inner_lock for the node lookups and node refcounts */
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -968,7 +1355,7 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
@@ -982,6 +1369,13 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node->latency);
+	kfree(node);
+	binder_stats_deleted(BINDER_STAT_NODE);
+}
+
 static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			   struct list_head *target_list)
 {
@@ -1052,15 +1446,18 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
+			binder_free_node(node);
 		}
 	}
 
 	return 0;
 }
 
-
+/*
+ * Caller holds proc->outer_lock for the ref lookups and ref refcounts.
+ * binder_get_ref_for_node() and binder_inc_ref() also need the node lock,
+ * binder_dec_ref() and binder_delete_ref() take it themselves.
+ */
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
 {
@@ -1103,7 +1500,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1149,6 +1546,8 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	struct mutex *node_lock = binder_node_mutex(ref->node);
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
@@ -1156,16 +1555,20 @@ static void binder_delete_ref(struct binder_ref *ref)
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+	mutex_lock(node_lock);
 	if (ref->strong)
 		binder_dec_node(ref->node, 1, 1);
 	hlist_del(&ref->node_entry);
 	binder_dec_node(ref->node, 0, 1);
+	mutex_unlock(node_lock);
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		mutex_lock(&ref->proc->inner_lock);
 		list_del(&ref->death->work.entry);
+		mutex_unlock(&ref->proc->inner_lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1208,8 +1611,12 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 		}
 		ref->strong--;
 		if (ref->strong == 0) {
+			struct mutex *node_lock = binder_node_mutex(ref->node);
 			int ret;
+
+			mutex_lock(node_lock);
 			ret = binder_dec_node(ref->node, strong, 1);
+			mutex_unlock(node_lock);
 			if (ret)
 				return ret;
 		}
@@ -1228,6 +1635,38 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
+static void binder_latency_add(struct binder_latency_hist *hist, u64 us)
+{
+	hist->count++;
+	hist->total_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+	hist->buckets[min(fls64(us), BINDER_LATENCY_BUCKETS - 1)]++;
+}
+
+/* Caller holds proc->inner_lock, node belongs to proc */
+static void binder_account_latency(struct binder_proc *proc,
+				   struct binder_transaction *t,
+				   struct binder_node *node)
+{
+	s64 us = ktime_us_delta(ktime_get(), t->start_time);
+
+	if (us < 0)
+		us = 0;
+	trace_binder_transaction_latency(proc, t, node, us);
+	binder_latency_add(&proc->latency, us);
+	if (node == NULL)
+		return;
+	if (node->latency == NULL)
+		node->latency = kzalloc(sizeof(*node->latency), GFP_KERNEL);
+	if (node->latency)
+		binder_latency_add(node->latency, us);
+}
+
+/*
+ * Caller holds target_thread->proc->inner_lock, and t->to_proc->inner_lock
+ * unless t->buffer has already been detached.
+ */
 static void binder_pop_transaction(struct binder_thread *target_thread,
 				   struct binder_transaction *t)
 {
@@ -1253,6 +1692,9 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	while (1) {
 		target_thread = t->from;
 		if (target_thread) {
+			struct binder_proc *target_proc = target_thread->proc;
+
+			mutex_lock(&target_proc->inner_lock);
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
 				target_thread->return_error2 =
@@ -1276,6 +1718,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 					target_thread->pid,
 					target_thread->return_error);
 			}
+			mutex_unlock(&target_proc->inner_lock);
 			return;
 		} else {
 			struct binder_transaction *next = t->from_parent;
@@ -1312,8 +1755,13 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 		     proc->pid, buffer->debug_id,
 		     buffer->data_size, buffer->offsets_size, failed_at);
 
-	if (buffer->target_node)
+	if (buffer->target_node) {
+		struct mutex *node_lock = binder_node_mutex(buffer->target_node);
+
+		mutex_lock(node_lock);
 		binder_dec_node(buffer->target_node, 1, 0);
+		mutex_unlock(node_lock);
+	}
 
 	offp = (size_t *)(buffer->data + ALIGN(buffer->data_size, sizeof(void *)));
 	if (failed_at)
@@ -1334,8 +1782,12 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 		switch (fp->type) {
 		case BINDER_TYPE_BINDER:
 		case BINDER_TYPE_WEAK_BINDER: {
-			struct binder_node *node = binder_get_node(proc, fp->binder);
+			struct binder_node *node;
+
+			mutex_lock(&proc->inner_lock);
+			node = binder_get_node(proc, fp->binder);
 			if (node == NULL) {
+				mutex_unlock(&proc->inner_lock);
 				printk(KERN_ERR "binder: transaction release %d"
 				       " bad node %p\n", debug_id, fp->binder);
 				break;
@@ -1344,11 +1796,16 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        node %d u%p\n",
 				     node->debug_id, node->ptr);
 			binder_dec_node(node, fp->type == BINDER_TYPE_BINDER, 0);
+			mutex_unlock(&proc->inner_lock);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+
+			mutex_lock(&proc->outer_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				printk(KERN_ERR "binder: transaction release %d"
 				       " bad handle %ld\n", debug_id,
 				       fp->handle);
@@ -1358,6 +1815,7 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        ref %d desc %d (node %d)\n",
 				     ref->debug_id, ref->desc, ref->node->debug_id);
 			binder_dec_ref(ref, fp->type == BINDER_TYPE_HANDLE);
+			mutex_unlock(&proc->outer_lock);
 		} break;
 
 		case BINDER_TYPE_FD:
@@ -1389,6 +1847,7 @@ static void binder_transaction(struct binder_proc *proc,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	struct mutex *node_lock;
 	uint32_t return_error;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
@@ -1400,8 +1859,10 @@ static void binder_transaction(struct binder_proc *proc,
 	e->offsets_size = tr->offsets_size;
 
 	if (reply) {
+		mutex_lock(&proc->inner_lock);
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
+			mutex_unlock(&proc->inner_lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 					  "with no transaction stack\n",
 					  proc->pid, thread->pid);
@@ -1410,6 +1871,7 @@ static void binder_transaction(struct binder_proc *proc,
 		}
 		binder_set_nice(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
+			mutex_unlock(&proc->inner_lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
 				" transaction %d has target %d:%d\n",
@@ -1423,11 +1885,20 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_call_stack;
 		}
 		thread->transaction_stack = in_reply_to->to_parent;
+		binder_account_latency(proc, in_reply_to, in_reply_to->buffer ?
+				       in_reply_to->buffer->target_node : NULL);
+		if (in_reply_to->buffer) {
+			in_reply_to->buffer->transaction = NULL;
+			in_reply_to->buffer = NULL;
+		}
 		target_thread = in_reply_to->from;
+		mutex_unlock(&proc->inner_lock);
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		target_proc = target_thread->proc;
+		mutex_lock(&target_proc->inner_lock);
 		if (target_thread->transaction_stack != in_reply_to) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad target transaction stack %d, "
@@ -1436,17 +1907,20 @@ static void binder_transaction(struct binder_proc *proc,
 				target_thread->transaction_stack ?
 				target_thread->transaction_stack->debug_id : 0,
 				in_reply_to->debug_id);
+			mutex_unlock(&target_proc->inner_lock);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
 			target_thread = NULL;
 			goto err_dead_binder;
 		}
-		target_proc = target_thread->proc;
+		mutex_unlock(&target_proc->inner_lock);
 	} else {
 		if (tr->target.handle) {
 			struct binder_ref *ref;
+			mutex_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, tr->target.handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d got "
 					"transaction to invalid handle\n",
 					proc->pid, thread->pid);
@@ -1454,12 +1928,21 @@ static void binder_transaction(struct binder_proc *proc,
 				goto err_invalid_target_handle;
 			}
 			target_node = ref->node;
+			node_lock = binder_node_mutex(target_node);
+			mutex_lock(node_lock);
+			binder_inc_node(target_node, 1, 0, NULL);
+			mutex_unlock(node_lock);
+			mutex_unlock(&proc->outer_lock);
 		} else {
 			target_node = binder_context_mgr_node;
 			if (target_node == NULL) {
 				return_error = BR_DEAD_REPLY;
 				goto err_no_context_mgr_node;
 			}
+			node_lock = binder_node_mutex(target_node);
+			mutex_lock(node_lock);
+			binder_inc_node(target_node, 1, 0, NULL);
+			mutex_unlock(node_lock);
 		}
 		e->to_node = target_node->debug_id;
 		target_proc = target_node->proc;
@@ -1467,10 +1950,12 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		mutex_lock(&proc->inner_lock);
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
 			tmp = thread->transaction_stack;
 			if (tmp->to_thread != thread) {
+				mutex_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d got new "
 					"transaction with bad transaction stack"
 					", transaction %d has target %d:%d\n",
@@ -1481,12 +1966,18 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
+			/*
+			 * The callers further down this stack are all blocked
+			 * waiting for replies, so their transactions cannot
+			 * go away under us.
+			 */
 			while (tmp) {
 				if (tmp->from && tmp->from->proc == target_proc)
 					target_thread = tmp->from;
 				tmp = tmp->from_parent;
 			}
 		}
+		mutex_unlock(&proc->inner_lock);
 	}
 	if (target_thread) {
 		e->to_thread = target_thread->pid;
@@ -1513,7 +2004,8 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
+	t->start_time = ktime_get();
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1549,12 +2041,15 @@ static void binder_transaction(struct binder_proc *proc,
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
+	/*
+	 * The buffer is not visible to target_proc until t is queued, so it
+	 * can be filled in without any locks.  It takes over the reference
+	 * on target_node.
+	 */
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
+	target_node = NULL;
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
@@ -1575,9 +2070,10 @@ static void binder_transaction(struct binder_proc *proc,
 			"invalid offsets size, %zd\n",
 			proc->pid, thread->pid, tr->offsets_size);
 		return_error = BR_FAILED_REPLY;
-		goto err_bad_offset;
+		goto err_bad_offsets_size;
 	}
 	off_end = (void *)offp + tr->offsets_size;
+	binder_lock_refs(proc, target_proc);
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
 		if (*offp > t->buffer->data_size - sizeof(*fp) ||
@@ -1594,10 +2090,14 @@ static void binder_transaction(struct binder_proc *proc,
 		case BINDER_TYPE_BINDER:
 		case BINDER_TYPE_WEAK_BINDER: {
 			struct binder_ref *ref;
-			struct binder_node *node = binder_get_node(proc, fp->binder);
+			struct binder_node *node;
+
+			mutex_lock(&proc->inner_lock);
+			node = binder_get_node(proc, fp->binder);
 			if (node == NULL) {
 				node = binder_new_node(proc, fp->binder, fp->cookie);
 				if (node == NULL) {
+					mutex_unlock(&proc->inner_lock);
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
@@ -1605,6 +2105,7 @@ static void binder_transaction(struct binder_proc *proc,
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
+				mutex_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d sending u%p "
 					"node %d, cookie mismatch %p != %p\n",
 					proc->pid, thread->pid,
@@ -1614,6 +2115,7 @@ static void binder_transaction(struct binder_proc *proc,
 			}
 			ref = binder_get_ref_for_node(target_proc, node);
 			if (ref == NULL) {
+				mutex_unlock(&proc->inner_lock);
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
@@ -1624,6 +2126,7 @@ static void binder_transaction(struct binder_proc *proc,
 			fp->handle = ref->desc;
 			binder_inc_ref(ref, fp->type == BINDER_TYPE_HANDLE,
 				       &thread->todo);
+			mutex_unlock(&proc->inner_lock);
 
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        node %d u%p -> ref %d desc %d\n",
@@ -1641,6 +2144,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_failed;
 			}
+			node_lock = binder_node_mutex(ref->node);
+			mutex_lock(node_lock);
 			if (ref->node->proc == target_proc) {
 				if (fp->type == BINDER_TYPE_HANDLE)
 					fp->type = BINDER_TYPE_BINDER;
@@ -1657,6 +2162,7 @@ static void binder_transaction(struct binder_proc *proc,
 				struct binder_ref *new_ref;
 				new_ref = binder_get_ref_for_node(target_proc, ref->node);
 				if (new_ref == NULL) {
+					mutex_unlock(node_lock);
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_get_ref_for_node_failed;
 				}
@@ -1667,6 +2173,7 @@ static void binder_transaction(struct binder_proc *proc,
 					     ref->debug_id, ref->desc, new_ref->debug_id,
 					     new_ref->desc, ref->node->debug_id);
 			}
+			mutex_unlock(node_lock);
 		} break;
 
 		case BINDER_TYPE_FD: {
@@ -1680,7 +2187,7 @@ static void binder_transaction(struct binder_proc *proc,
 					return_error = BR_FAILED_REPLY;
 					goto err_fd_not_allowed;
 				}
-			} else if (!target_node->accept_fds) {
+			} else if (!t->buffer->target_node->accept_fds) {
 				binder_user_error("binder: %d:%d got transaction with fd, %ld, but target does not allow fds\n",
 					proc->pid, thread->pid, fp->handle);
 				return_error = BR_FAILED_REPLY;
@@ -1715,15 +2222,29 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
-	if (reply) {
-		BUG_ON(t->buffer->async_transaction != 0);
-		binder_pop_transaction(target_thread, in_reply_to);
-	} else if (!(t->flags & TF_ONE_WAY)) {
+	binder_unlock_refs(proc, target_proc);
+
+	/*
+	 * Queue the transaction complete before t, so that it is always
+	 * returned ahead of a reply to t.
+	 */
+	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	mutex_lock(&proc->inner_lock);
+	list_add_tail(&tcomplete->entry, &thread->todo);
+	if (!reply && !(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
 		t->need_reply = 1;
 		t->from_parent = thread->transaction_stack;
 		thread->transaction_stack = t;
-	} else {
+	}
+	mutex_unlock(&proc->inner_lock);
+
+	mutex_lock(&target_proc->inner_lock);
+	if (reply) {
+		BUG_ON(t->buffer->async_transaction != 0);
+		binder_pop_transaction(target_thread, in_reply_to);
+	} else if (t->flags & TF_ONE_WAY) {
+		target_node = t->buffer->target_node;
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
 		if (target_node->has_async_transaction) {
@@ -1732,12 +2253,14 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	trace_binder_transaction(reply, t, t->buffer->target_node);
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
-	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
-	if (target_wait)
+	if (target_wait) {
+		trace_binder_wakeup(target_proc, target_thread);
 		wake_up_interruptible(target_wait);
+	}
+	mutex_unlock(&target_proc->inner_lock);
 	return;
 
 err_get_unused_fd_failed:
@@ -1748,6 +2271,8 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+	binder_unlock_refs(proc, target_proc);
+err_bad_offsets_size:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
@@ -1762,6 +2287,12 @@ err_alloc_t_failed:
 err_bad_call_stack:
 err_empty_call_stack:
 err_dead_binder:
+	if (target_node) {
+		node_lock = binder_node_mutex(target_node);
+		mutex_lock(node_lock);
+		binder_dec_node(target_node, 1, 0);
+		mutex_unlock(node_lock);
+	}
 err_invalid_target_handle:
 err_no_context_mgr_node:
 	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
@@ -1775,12 +2306,16 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
+	mutex_lock(&proc->inner_lock);
 	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
+		mutex_unlock(&proc->inner_lock);
 		binder_send_failed_reply(in_reply_to, return_error);
-	} else
+	} else {
 		thread->return_error = return_error;
+		mutex_unlock(&proc->inner_lock);
+	}
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1795,9 +2330,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1806,15 +2341,21 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		case BC_DECREFS: {
 			uint32_t target;
 			struct binder_ref *ref;
+			struct mutex *node_lock;
 			const char *debug_string;
 
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
+			mutex_lock(&proc->outer_lock);
 			if (target == 0 && binder_context_mgr_node &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
+				node_lock = binder_node_mutex(
+						binder_context_mgr_node);
+				mutex_lock(node_lock);
 				ref = binder_get_ref_for_node(proc,
 					       binder_context_mgr_node);
+				mutex_unlock(node_lock);
 				if (ref->desc != target) {
 					binder_user_error("binder: %d:"
 						"%d tried to acquire "
@@ -1826,6 +2367,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			} else
 				ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d refcou"
 					"nt change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1833,12 +2375,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			}
 			switch (cmd) {
 			case BC_INCREFS:
-				debug_string = "IncRefs";
-				binder_inc_ref(ref, 0, NULL);
-				break;
 			case BC_ACQUIRE:
-				debug_string = "Acquire";
-				binder_inc_ref(ref, 1, NULL);
+				debug_string = cmd == BC_INCREFS ?
+					"IncRefs" : "Acquire";
+				node_lock = binder_node_mutex(ref->node);
+				mutex_lock(node_lock);
+				binder_inc_ref(ref, cmd == BC_ACQUIRE, NULL);
+				mutex_unlock(node_lock);
 				break;
 			case BC_RELEASE:
 				debug_string = "Release";
@@ -1854,6 +2397,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
 				     proc->pid, thread->pid, debug_string, ref->debug_id,
 				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			mutex_unlock(&proc->outer_lock);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1868,8 +2412,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			mutex_lock(&proc->inner_lock);
 			node = binder_get_node(proc, node_ptr);
 			if (node == NULL) {
+				mutex_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d "
 					"%s u%p no match\n",
 					proc->pid, thread->pid,
@@ -1880,6 +2426,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				break;
 			}
 			if (cookie != node->cookie) {
+				mutex_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d %s u%p node %d"
 					" cookie mismatch %p != %p\n",
 					proc->pid, thread->pid,
@@ -1891,6 +2438,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			}
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
+					mutex_unlock(&proc->inner_lock);
 					binder_user_error("binder: %d:%d "
 						"BC_ACQUIRE_DONE node %d has "
 						"no pending acquire request\n",
@@ -1901,6 +2449,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				node->pending_strong_ref = 0;
 			} else {
 				if (node->pending_weak_ref == 0) {
+					mutex_unlock(&proc->inner_lock);
 					binder_user_error("binder: %d:%d "
 						"BC_INCREFS_DONE node %d has "
 						"no pending increfs request\n",
@@ -1916,6 +2465,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     proc->pid, thread->pid,
 				     cmd == BC_INCREFS_DONE ? "BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 				     node->debug_id, node->local_strong_refs, node->local_weak_refs);
+			mutex_unlock(&proc->inner_lock);
 			break;
 		}
 		case BC_ATTEMPT_ACQUIRE:
@@ -1933,25 +2483,32 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			/* keep another thread from freeing it too */
+			buffer->allow_user_free = 0;
+			mutex_unlock(&proc->alloc_lock);
 			binder_debug(BINDER_DEBUG_FREE_BUFFER,
 				     "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				     proc->pid, thread->pid, data_ptr, buffer->debug_id,
 				     buffer->transaction ? "active" : "finished");
 
+			mutex_lock(&proc->inner_lock);
 			if (buffer->transaction) {
 				buffer->transaction->buffer = NULL;
 				buffer->transaction = NULL;
@@ -1963,6 +2520,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				else
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
+			mutex_unlock(&proc->inner_lock);
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
 			break;
@@ -1983,6 +2541,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_REGISTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			mutex_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_ENTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2000,11 +2559,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				proc->requested_threads_started++;
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
+			mutex_unlock(&proc->inner_lock);
 			break;
 		case BC_ENTER_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_ENTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			mutex_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_REGISTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2013,12 +2574,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					proc->pid, thread->pid);
 			}
 			thread->looper |= BINDER_LOOPER_STATE_ENTERED;
+			mutex_unlock(&proc->inner_lock);
 			break;
 		case BC_EXIT_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_EXIT_LOOPER\n",
 				     proc->pid, thread->pid);
+			mutex_lock(&proc->inner_lock);
 			thread->looper |= BINDER_LOOPER_STATE_EXITED;
+			mutex_unlock(&proc->inner_lock);
 			break;
 
 		case BC_REQUEST_DEATH_NOTIFICATION:
@@ -2034,8 +2598,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void __user * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			mutex_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d %s "
 					"invalid ref %d\n",
 					proc->pid, thread->pid,
@@ -2055,6 +2621,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     cookie, ref->debug_id, ref->desc,
 				     ref->strong, ref->weak, ref->node->debug_id);
 
+			mutex_lock(&proc->inner_lock);
 			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
 				if (ref->death) {
 					binder_user_error("binder: %d:%"
@@ -2062,7 +2629,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"FICATION death notific"
 						"ation already set\n",
 						proc->pid, thread->pid);
-					break;
+					goto death_done;
 				}
 				death = kzalloc(sizeof(*death), GFP_KERNEL);
 				if (death == NULL) {
@@ -2071,7 +2638,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						     "binder: %d:%d "
 						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
 						     proc->pid, thread->pid);
-					break;
+					goto death_done;
 				}
 				binder_stats_created(BINDER_STAT_DEATH);
 				INIT_LIST_HEAD(&death->work.entry);
@@ -2093,7 +2660,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"CATION death notificat"
 						"ion not active\n",
 						proc->pid, thread->pid);
-					break;
+					goto death_done;
 				}
 				death = ref->death;
 				if (death->cookie != cookie) {
@@ -2104,7 +2671,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"%p != %p\n",
 						proc->pid, thread->pid,
 						death->cookie, cookie);
-					break;
+					goto death_done;
 				}
 				ref->death = NULL;
 				if (list_empty(&death->work.entry)) {
@@ -2120,6 +2687,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
 			}
+death_done:
+			mutex_unlock(&proc->inner_lock);
+			mutex_unlock(&proc->outer_lock);
 		} break;
 		case BC_DEAD_BINDER_DONE: {
 			struct binder_work *w;
@@ -2129,6 +2699,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			mutex_lock(&proc->inner_lock);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2140,6 +2711,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d BC_DEAD_BINDER_DONE %p found %p\n",
 				     proc->pid, thread->pid, cookie, death);
 			if (death == NULL) {
+				mutex_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d BC_DEAD"
 					"_BINDER_DONE %p not found\n",
 					proc->pid, thread->pid, cookie);
@@ -2156,6 +2728,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			mutex_unlock(&proc->inner_lock);
 		} break;
 
 		default:
@@ -2172,9 +2745,9 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2191,10 +2764,11 @@ static int binder_has_thread_work(struct binder_thread *thread)
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
-static int binder_thread_read(struct binder_proc *proc,
-			      struct binder_thread *thread,
-			      void  __user *buffer, int size,
-			      signed long *consumed, int non_block)
+/* Called and returns with proc->inner_lock held, drops it while waiting */
+static int __binder_thread_read(struct binder_proc *proc,
+				struct binder_thread *thread,
+				void  __user *buffer, int size,
+				signed long *consumed, int non_block)
 {
 	void __user *ptr = buffer + *consumed;
 	void __user *end = buffer + size;
@@ -2232,7 +2806,8 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->inner_lock);
+	up_read(&binder_main_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2256,7 +2831,8 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
+	mutex_lock(&proc->inner_lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2352,8 +2928,7 @@ retry:
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
-					binder_stats_deleted(BINDER_STAT_NODE);
+					binder_free_node(node);
 				} else {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p state unchanged\n",
@@ -2419,6 +2994,7 @@ retry:
 			tr.cookie = NULL;
 			cmd = BR_REPLY;
 		}
+		trace_binder_transaction_received(t);
 		tr.code = t->code;
 		tr.flags = t->flags;
 		tr.sender_euid = t->sender_euid;
@@ -2459,7 +3035,9 @@ retry:
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
 		list_del(&t->work.entry);
+		mutex_lock(&proc->alloc_lock);
 		t->buffer->allow_user_free = 1;
+		mutex_unlock(&proc->alloc_lock);
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
@@ -2490,6 +3068,20 @@ done:
 	return 0;
 }
 
+static int binder_thread_read(struct binder_proc *proc,
+			      struct binder_thread *thread,
+			      void  __user *buffer, int size,
+			      signed long *consumed, int non_block)
+{
+	int ret;
+
+	mutex_lock(&proc->inner_lock);
+	ret = __binder_thread_read(proc, thread, buffer, size, consumed,
+				   non_block);
+	mutex_unlock(&proc->inner_lock);
+	return ret;
+}
+
 static void binder_release_work(struct list_head *list)
 {
 	struct binder_work *w;
@@ -2521,6 +3113,7 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 	struct rb_node *parent = NULL;
 	struct rb_node **p = &proc->threads.rb_node;
 
+	mutex_lock(&proc->inner_lock);
 	while (*p) {
 		parent = *p;
 		thread = rb_entry(parent, struct binder_thread, rb_node);
@@ -2534,8 +3127,10 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 	}
 	if (*p == NULL) {
 		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
-		if (thread == NULL)
+		if (thread == NULL) {
+			mutex_unlock(&proc->inner_lock);
 			return NULL;
+		}
 		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
@@ -2547,9 +3142,11 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		thread->return_error = BR_OK;
 		thread->return_error2 = BR_OK;
 	}
+	mutex_unlock(&proc->inner_lock);
 	return thread;
 }
 
+/* Caller holds binder_main_lock for writing */
 static int binder_free_thread(struct binder_proc *proc,
 			      struct binder_thread *thread)
 {
@@ -2598,12 +3195,14 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_main_lock);
 	thread = binder_get_thread(proc);
 
+	mutex_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->inner_lock);
+	up_read(&binder_main_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2628,6 +3227,8 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	int max_threads;
+	bool exclusive;
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
@@ -2635,7 +3236,15 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	/*
+	 * Setting the context manager and thread exit touch global or
+	 * cross-thread state, everything else only needs per-proc locks.
+	 */
+	exclusive = cmd == BINDER_SET_CONTEXT_MGR || cmd == BINDER_THREAD_EXIT;
+	if (exclusive)
+		down_write(&binder_main_lock);
+	else
+		down_read(&binder_main_lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2688,10 +3297,13 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		break;
 	}
 	case BINDER_SET_MAX_THREADS:
-		if (copy_from_user(&proc->max_threads, ubuf, sizeof(proc->max_threads))) {
+		if (copy_from_user(&max_threads, ubuf, sizeof(max_threads))) {
 			ret = -EINVAL;
 			goto err;
 		}
+		mutex_lock(&proc->inner_lock);
+		proc->max_threads = max_threads;
+		mutex_unlock(&proc->inner_lock);
 		break;
 	case BINDER_SET_CONTEXT_MGR:
 		if (binder_context_mgr_node != NULL) {
@@ -2742,9 +3354,15 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	}
 	ret = 0;
 err:
-	if (thread)
+	if (thread) {
+		mutex_lock(&proc->inner_lock);
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+		mutex_unlock(&proc->inner_lock);
+	}
+	if (exclusive)
+		up_write(&binder_main_lock);
+	else
+		up_read(&binder_main_lock);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2837,7 +3455,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
 
-	if (binder_update_page_range(proc, 1, proc->buffer, proc->buffer + PAGE_SIZE, vma)) {
+	if (binder_alloc_page_range(proc, proc->buffer, proc->buffer + PAGE_SIZE, vma)) {
 		ret = -ENOMEM;
 		failure_string = "alloc small buf";
 		goto err_alloc_small_buf_failed;
@@ -2884,14 +3502,17 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->outer_lock);
+	mutex_init(&proc->inner_lock);
+	mutex_init(&proc->alloc_lock);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
-	binder_stats_created(BINDER_STAT_PROC);
-	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_stats_created(BINDER_STAT_PROC);
+	mutex_lock(&binder_procs_lock);
+	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_unlock(&binder_procs_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2916,6 +3537,8 @@ static void binder_deferred_flush(struct binder_proc *proc)
 {
 	struct rb_node *n;
 	int wake_count = 0;
+
+	mutex_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n)) {
 		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
@@ -2925,6 +3548,7 @@ static void binder_deferred_flush(struct binder_proc *proc)
 		}
 	}
 	wake_up_interruptible_all(&proc->wait);
+	mutex_unlock(&proc->inner_lock);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
 		     "binder_flush: %d woke %d threads\n", proc->pid,
@@ -2940,6 +3564,7 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	return 0;
 }
 
+/* Caller holds binder_main_lock for writing */
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
@@ -2950,7 +3575,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_del(&proc->proc_node);
+	mutex_unlock(&binder_procs_lock);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder_release: %d context_mgr_node gone\n",
@@ -2974,8 +3601,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
 		if (hlist_empty(&node->refs)) {
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
+			binder_free_node(node);
 		} else {
 			struct binder_ref *ref;
 			int death = 0;
@@ -2983,7 +3609,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 			node->proc = NULL;
 			node->local_strong_refs = 0;
 			node->local_weak_refs = 0;
+			mutex_lock(&binder_dead_nodes_lock);
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
+			mutex_unlock(&binder_dead_nodes_lock);
 
 			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
 				incoming_refs++;
@@ -3068,10 +3696,10 @@ static void binder_deferred_func(struct work_struct *work)
 {
 	struct binder_proc *proc;
 	struct files_struct *files;
+	bool exclusive;
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3085,6 +3713,17 @@ static void binder_deferred_func(struct work_struct *work)
 		}
 		mutex_unlock(&binder_deferred_lock);
 
+		/*
+		 * Dropping the files and tearing down the proc must not race
+		 * with any ioctl, a flush only needs the proc's own lock.
+		 */
+		exclusive = defer & (BINDER_DEFERRED_PUT_FILES |
+				     BINDER_DEFERRED_RELEASE);
+		if (exclusive)
+			down_write(&binder_main_lock);
+		else
+			down_read(&binder_main_lock);
+
 		files = NULL;
 		if (defer & BINDER_DEFERRED_PUT_FILES) {
 			files = proc->files;
@@ -3098,7 +3737,10 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		if (exclusive)
+			up_write(&binder_main_lock);
+		else
+			up_read(&binder_main_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3351,17 +3993,19 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		if (atomic_read(&stats->bc[i]))
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i],
+				   atomic_read(&stats->bc[i]));
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		if (atomic_read(&stats->br[i]))
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i],
+				   atomic_read(&stats->br[i]));
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3369,11 +4013,116 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
+	}
+}
+
+static const char *binder_alloc_size_class_strings[] = {
+	"<256",
+	"<1K",
+	"<4K",
+	"<16K",
+	"<64K",
+	"<256K",
+	">=256K"
+};
+
+static void print_binder_alloc_stats(struct seq_file *m,
+				     struct binder_proc *proc)
+{
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	struct rb_node *n;
+	size_t free_space = 0;
+	size_t largest = 0;
+	u64 avg_ns;
+	int count = 0;
+	int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(stats->size_classes) !=
+		     ARRAY_SIZE(binder_alloc_size_class_strings));
+
+	avg_ns = stats->alloc_time_ns;
+	if (stats->allocs)
+		do_div(avg_ns, stats->allocs);
+	seq_printf(m, "  buffer allocs: %lu failed %lu avg %llu ns "
+		   "max %llu ns\n", stats->allocs, stats->alloc_failures,
+		   (unsigned long long)avg_ns,
+		   (unsigned long long)stats->max_alloc_time_ns);
+	seq_puts(m, "  buffer size classes:");
+	for (i = 0; i < ARRAY_SIZE(stats->size_classes); i++)
+		seq_printf(m, " %s %lu", binder_alloc_size_class_strings[i],
+			   stats->size_classes[i]);
+	seq_puts(m, "\n");
+	seq_printf(m, "  buffer space: allocated %zd high watermark %zd\n",
+		   stats->allocated, stats->max_allocated);
+
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		struct binder_buffer *buffer = rb_entry(n,
+				struct binder_buffer, rb_node);
+		size_t size = binder_buffer_size(proc, buffer);
+
+		count++;
+		free_space += size;
+		if (size > largest)
+			largest = size;
+	}
+	seq_printf(m, "  buffer free space: %zd in %d buffers, "
+		   "largest %zd\n", free_space, count, largest);
+	seq_printf(m, "  buffer pages: mapped %d high watermark %d "
+		   "cached %d limit %d\n", stats->pages_mapped,
+		   stats->max_pages_mapped, proc->pages_cached,
+		   max(binder_cache_pages, proc->cache_limit));
+	seq_printf(m, "  buffer pages: allocated %lu reused %lu freed %lu\n",
+		   stats->pages_allocated, stats->pages_reused,
+		   stats->pages_freed);
+}
+
+static void print_binder_latency(struct seq_file *m, const char *prefix,
+				 struct binder_latency_hist *hist)
+{
+	u64 avg_us = hist->total_us;
+	int i;
+
+	do_div(avg_us, hist->count);
+	seq_printf(m, "%slatency: %lu calls avg %llu us max %llu us\n",
+		   prefix, hist->count, (unsigned long long)avg_us,
+		   (unsigned long long)hist->max_us);
+	seq_printf(m, "%s ", prefix);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS - 1; i++) {
+		if (hist->buckets[i])
+			seq_printf(m, " <%lluus %lu", 1ULL << i,
+				   hist->buckets[i]);
+	}
+	if (hist->buckets[i])
+		seq_printf(m, " >=%lluus %lu", 1ULL << (i - 1),
+			   hist->buckets[i]);
+	seq_puts(m, "\n");
+}
+
+static void print_binder_proc_latency(struct seq_file *m,
+				      struct binder_proc *proc)
+{
+	struct rb_node *n;
+
+	if (!proc->latency.count)
+		return;
+	seq_printf(m, "proc %d\n", proc->pid);
+	print_binder_latency(m, "  ", &proc->latency);
+	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+		struct binder_node *node = rb_entry(n, struct binder_node,
+						    rb_node);
+
+		if (!node->latency || !node->latency->count)
+			continue;
+		seq_printf(m, "  node %d: u%p c%p\n", node->debug_id,
+			   node->ptr, node->cookie);
+		print_binder_latency(m, "    ", node->latency);
 	}
 }
 
@@ -3414,6 +4163,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	print_binder_alloc_stats(m, proc);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3438,8 +4188,10 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	struct binder_node *node;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_main_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder state:\n");
 
@@ -3450,8 +4202,10 @@ static int binder_state_show(struct seq_file *m, void *unused)
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_main_lock);
+	}
 	return 0;
 }
 
@@ -3461,8 +4215,10 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_main_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3470,8 +4226,10 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_main_lock);
+	}
 	return 0;
 }
 
@@ -3481,14 +4239,39 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
-	if (do_lock)
-		mutex_lock(&binder_lock);
+	if (do_lock) {
+		down_write(&binder_main_lock);
+		mutex_lock(&binder_procs_lock);
+	}
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
-	if (do_lock)
-		mutex_unlock(&binder_lock);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_main_lock);
+	}
+	return 0;
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock) {
+		down_write(&binder_main_lock);
+		mutex_lock(&binder_procs_lock);
+	}
+
+	seq_puts(m, "binder latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
+		print_binder_proc_latency(m, proc);
+	if (do_lock) {
+		mutex_unlock(&binder_procs_lock);
+		up_write(&binder_main_lock);
+	}
 	return 0;
 }
 
@@ -3498,11 +4281,13 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_main_lock);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
+	print_binder_alloc_stats(m, proc);
+	print_binder_proc_latency(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_main_lock);
 	return 0;
 }
 
@@ -3550,6 +4335,7 @@ static struct miscdevice binder_miscdev = {
 BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
+BINDER_DEBUG_ENTRY(latency);
 BINDER_DEBUG_ENTRY(transaction_log);
 
 static int __init binder_init(void)
@@ -3560,6 +4346,8 @@ static int __init binder_init(void)
 	if (!binder_deferred_workqueue)
 		return -ENOMEM;
 
+	register_shrinker(&binder_shrinker);
+
 	binder_debugfs_dir_entry_root = debugfs_create_dir("binder", NULL);
 	if (binder_debugfs_dir_entry_root)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
@@ -3581,6 +4369,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    NULL,
 				    &binder_transactions_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 		debugfs_create_file("transaction_log",
 				    S_IRUGO,
 				    binder_debugfs_dir_entry_root,
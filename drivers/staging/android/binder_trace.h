@@ -0,0 +1,145 @@
+/* drivers/staging/android/binder_trace.h
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Only included from binder.c, after the structures below are defined.
+ */
+struct binder_proc;
+struct binder_thread;
+struct binder_node;
+struct binder_transaction;
+
+TRACE_EVENT(binder_transaction,
+	TP_PROTO(bool reply, struct binder_transaction *t,
+		 struct binder_node *target_node),
+	TP_ARGS(reply, t, target_node),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, target_node)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(int, reply)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+		__field(size_t, data_size)
+		__field(size_t, offsets_size)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->target_node = target_node ? target_node->debug_id : 0;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+		__entry->reply = reply;
+		__entry->code = t->code;
+		__entry->flags = t->flags;
+		__entry->data_size = t->buffer->data_size;
+		__entry->offsets_size = t->buffer->offsets_size;
+	),
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d "
+		  "reply=%d flags=0x%x code=0x%x size=%zd-%zd",
+		  __entry->debug_id, __entry->target_node,
+		  __entry->to_proc, __entry->to_thread,
+		  __entry->reply, __entry->flags, __entry->code,
+		  __entry->data_size, __entry->offsets_size)
+);
+
+TRACE_EVENT(binder_transaction_received,
+	TP_PROTO(struct binder_transaction *t),
+	TP_ARGS(t),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+	),
+	TP_printk("transaction=%d", __entry->debug_id)
+);
+
+TRACE_EVENT(binder_transaction_latency,
+	TP_PROTO(struct binder_proc *proc, struct binder_transaction *t,
+		 struct binder_node *node, u64 latency_us),
+	TP_ARGS(proc, t, node, latency_us),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, proc)
+		__field(int, node)
+		__field(unsigned int, code)
+		__field(u64, latency_us)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->proc = proc->pid;
+		__entry->node = node ? node->debug_id : 0;
+		__entry->code = t->code;
+		__entry->latency_us = latency_us;
+	),
+	TP_printk("transaction=%d proc=%d node=%d code=0x%x latency=%llu us",
+		  __entry->debug_id, __entry->proc, __entry->node,
+		  __entry->code, (unsigned long long)__entry->latency_us)
+);
+
+TRACE_EVENT(binder_alloc_buf,
+	TP_PROTO(struct binder_proc *proc, size_t data_size,
+		 size_t offsets_size, int is_async, bool failed, u64 ns),
+	TP_ARGS(proc, data_size, offsets_size, is_async, failed, ns),
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(size_t, data_size)
+		__field(size_t, offsets_size)
+		__field(int, is_async)
+		__field(int, failed)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->data_size = data_size;
+		__entry->offsets_size = offsets_size;
+		__entry->is_async = is_async;
+		__entry->failed = failed;
+		__entry->ns = ns;
+	),
+	TP_printk("proc=%d size=%zd-%zd async=%d failed=%d time=%llu ns",
+		  __entry->proc, __entry->data_size, __entry->offsets_size,
+		  __entry->is_async, __entry->failed,
+		  (unsigned long long)__entry->ns)
+);
+
+TRACE_EVENT(binder_wakeup,
+	TP_PROTO(struct binder_proc *proc, struct binder_thread *thread),
+	TP_ARGS(proc, thread),
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(int, thread)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->thread = thread ? thread->pid : 0;
+	),
+	TP_printk("proc=%d thread=%d", __entry->proc, __entry->thread)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
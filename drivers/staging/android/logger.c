@@ -25,6 +25,8 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,16 +35,24 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Writers reserve room for their entry under the spinlock 'lock', copy the
+ * payload in without holding anything and then commit it. All offsets are
+ * free running positions; logger_offset() turns them into buffer indices.
+ * Readers never take 'lock': anything in [head, c_off) is readable, and a
+ * reader that finds itself behind 'head' was lapped by a writer. 'info'
+ * mirrors head and c_off for readers that mmap() the log.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
+	struct logger_ring_info	*info;	/* page shared with mmap() readers */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
+	wait_queue_head_t	commit_wq; /* writers waiting for commits */
+	spinlock_t		lock;	/* protects reservations */
+	size_t			w_off;	/* end of the last reservation */
+	size_t			c_off;	/* end of the committed entries */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
 };
@@ -51,14 +61,18 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by the mutex 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
+	struct mutex		mutex;	/* serializes readers of this file */
 	size_t			r_off;	/* current read head offset */
+	int			mode;	/* LOGGER_READ_SINGLE or _BATCH */
 };
 
+/* set in logger_entry.__pad while the payload is being copied in */
+#define LOGGER_ENTRY_BUSY	1
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -87,9 +101,7 @@ static inline struct logger_log *file_get_log(struct file *file)
 
 /*
  * get_entry_len - Grabs the length of the payload of the next entry starting
- * from 'off'.
- *
- * Caller needs to hold log->mutex.
+ * from buffer index 'off'.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -107,17 +119,99 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 	return sizeof(struct logger_entry) + val;
 }
 
+/*
+ * set_entry_pad - writes the __pad field of the entry starting at buffer
+ * index 'off'.
+ *
+ * Caller needs to hold log->lock.
+ */
+static void set_entry_pad(struct logger_log *log, size_t off, __u16 val)
+{
+	size_t pad = logger_offset(off + offsetof(struct logger_entry, __pad));
+
+	switch (log->size - pad) {
+	case 1:
+		memcpy(log->buffer + pad, &val, 1);
+		memcpy(log->buffer, ((char *) &val) + 1, 1);
+		break;
+	default:
+		memcpy(log->buffer + pad, &val, 2);
+	}
+}
+
+/*
+ * get_entry_pad - reads the __pad field of the entry starting at buffer
+ * index 'off'.
+ *
+ * Caller needs to hold log->lock.
+ */
+static __u16 get_entry_pad(struct logger_log *log, size_t off)
+{
+	size_t pad = logger_offset(off + offsetof(struct logger_entry, __pad));
+	__u16 val;
+
+	switch (log->size - pad) {
+	case 1:
+		memcpy(&val, log->buffer + pad, 1);
+		memcpy(((char *) &val) + 1, log->buffer, 1);
+		break;
+	default:
+		memcpy(&val, log->buffer + pad, 2);
+	}
+
+	return val;
+}
+
+/*
+ * reader_valid - is 'off' still inside the readable part [head, c_off] of
+ * the log, i.e. has the reader not been lapped by a writer yet?
+ */
+static inline int reader_valid(struct logger_log *log, size_t off)
+{
+	size_t head, c_off;
+
+	head = ACCESS_ONCE(log->head);
+	smp_rmb();
+	c_off = ACCESS_ONCE(log->c_off);
+
+	return c_off - off <= c_off - head;
+}
+
+/*
+ * fix_up_reader - pulls a reader that was lapped by the writers forward to
+ * the oldest entry still in the log. Returns nonzero if there is something
+ * to read.
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static int fix_up_reader(struct logger_log *log, struct logger_reader *reader)
+{
+	size_t c_off;
+
+	if (!reader_valid(log, reader->r_off))
+		reader->r_off = ACCESS_ONCE(log->head);
+	smp_rmb();
+
+	/* the entries in front of c_off must be read after c_off itself */
+	c_off = ACCESS_ONCE(log->c_off);
+	smp_rmb();
+
+	return c_off != reader->r_off;
+}
+
 /*
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * user-space buffer 'buf'. Returns 'count' on success, or zero if a writer
+ * lapped the reader while we were copying and the caller has to retry.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
 				   char __user *buf,
 				   size_t count)
 {
+	size_t off = logger_offset(reader->r_off);
 	size_t len;
 
 	/*
@@ -125,8 +219,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,11 +231,57 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
+	/* writers move the head past an entry before overwriting it */
+	smp_rmb();
+	if (unlikely(!reader_valid(log, reader->r_off)))
+		return 0;
+
+	reader->r_off += count;
 
 	return count;
 }
 
+/*
+ * do_read_batch_to_user - reads whole entries, starting with the one of
+ * length 'len' at the read head, into 'buf' for as long as they fit into
+ * 'count' bytes. Each entry is checked against the commit offset and for a
+ * lapping writer before it is copied; once a writer laps us, the entries
+ * read so far are returned. Returns zero if not even the first entry could
+ * be read and the caller has to retry.
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t do_read_batch_to_user(struct logger_log *log,
+				     struct logger_reader *reader,
+				     char __user *buf, size_t count,
+				     size_t len)
+{
+	size_t done = 0;
+	size_t c_off;
+	ssize_t ret;
+
+	while (1) {
+		ret = do_read_log_to_user(log, reader, buf + done, len);
+		if (ret <= 0)
+			return done ? done : ret;
+		done += ret;
+
+		c_off = ACCESS_ONCE(log->c_off);
+		smp_rmb();
+		if (c_off == reader->r_off)
+			break;
+
+		len = get_entry_len(log, logger_offset(reader->r_off));
+		smp_rmb();
+		if (unlikely(!reader_valid(log, reader->r_off)))
+			break;
+		if (len > c_off - reader->r_off || len > count - done)
+			break;
+	}
+
+	return done;
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -149,7 +289,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in LOGGER_READ_BATCH mode
+ * 	  as many whole entries as fit into the buffer
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -162,13 +303,13 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
+	mutex_lock(&reader->mutex);
+
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = !fix_up_reader(log, reader);
 		if (!ret)
 			break;
 
@@ -182,152 +323,164 @@ start:
 			break;
 		}
 
+		mutex_unlock(&reader->mutex);
 		schedule();
+		mutex_lock(&reader->mutex);
 	}
 
 	finish_wait(&log->wq, &wait);
 	if (ret)
-		return ret;
+		goto out;
 
-	mutex_lock(&log->mutex);
+	/* get the size of the next entry */
+	ret = get_entry_len(log, logger_offset(reader->r_off));
+	smp_rmb();
 
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	/* did a writer lap us while we looked at the header? */
+	if (unlikely(!reader_valid(log, reader->r_off)))
 		goto start;
-	}
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* get exactly one entry, or a batch of them, from the log */
+	if (reader->mode == LOGGER_READ_BATCH)
+		ret = do_read_batch_to_user(log, reader, buf, count, ret);
+	else
+		ret = do_read_log_to_user(log, reader, buf, ret);
+	if (unlikely(!ret))
+		goto start;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at position 'off'
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
 {
-	size_t count = 0;
+	size_t len;
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
-	return off;
-}
-
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
-	}
-
-	return 0;
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * do_write_log_user - writes 'count' bytes from the user-space buffer 'buf'
+ * to the log 'log' at position 'off'
  *
- * The caller needs to hold log->mutex.
+ * Returns 'count' on success, negative error code on failure.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
+				      const void __user *buf, size_t count)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	size_t len;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
+		return -EFAULT;
+
+	if (count != len)
+		if (copy_from_user(log->buffer, buf + len, count - len))
+			return -EFAULT;
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	return count;
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * reserve_entry - reserves room for an entry of 'len' bytes, writes its
+ * header and returns the position the entry starts at.
  *
- * The caller needs to hold log->mutex.
+ * The head, and with it every reader still behind it, is pulled forward to
+ * the first entry that survives the reservation. Only committed entries can
+ * be dropped this way, so if the entries still being copied in by other
+ * writers fill the log we wait for them to commit first.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static size_t reserve_entry(struct logger_log *log,
+			    struct logger_entry *header, size_t len)
 {
-	size_t len;
+	size_t off;
+
+	spin_lock(&log->lock);
+	while (unlikely(log->w_off + len - log->c_off > log->size)) {
+		spin_unlock(&log->lock);
+		wait_event(log->commit_wq,
+			   ACCESS_ONCE(log->w_off) + len -
+			   ACCESS_ONCE(log->c_off) <= log->size);
+		spin_lock(&log->lock);
+	}
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	off = log->w_off;
+	log->w_off += len;
 
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
+	while (log->w_off - log->head > log->size)
+		log->head += get_entry_len(log, logger_offset(log->head));
+	log->info->head = log->head;
+
+	/* lapped readers must see the new head before the new data */
+	smp_wmb();
 
-	log->w_off = logger_offset(log->w_off + count);
+	header->__pad = LOGGER_ENTRY_BUSY;
+	do_write_log(log, off, header, sizeof(struct logger_entry));
+	spin_unlock(&log->lock);
 
+	return off;
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * commit_entry - marks the entry at 'off' as complete and makes every
+ * completed entry in front of the oldest busy one visible to readers.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void commit_entry(struct logger_log *log, size_t off)
 {
-	size_t len;
+	size_t c_off;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	/* the payload must be in place before the entry is marked done */
+	smp_wmb();
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+	spin_lock(&log->lock);
+	set_entry_pad(log, off, 0);
 
-	log->w_off = logger_offset(log->w_off + count);
+	c_off = log->c_off;
+	while (c_off != log->w_off && !get_entry_pad(log, c_off))
+		c_off += get_entry_len(log, logger_offset(c_off));
 
-	return count;
+	smp_wmb();
+	log->c_off = c_off;
+	log->info->tail = c_off;
+	spin_unlock(&log->lock);
+
+	smp_mb();
+	if (waitqueue_active(&log->commit_wq))
+		wake_up(&log->commit_wq);
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * Concurrent writers only serialize for the few instructions it takes to
+ * reserve and commit their entry; the payload is copied in unlocked.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t off, pos;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -342,17 +495,9 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	off = reserve_entry(log, &header,
+			    sizeof(struct logger_entry) + header.len);
+	pos = off + sizeof(struct logger_entry);
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -362,18 +507,35 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, pos + ret, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			/*
+			 * Other writers may already have reserved space behind
+			 * us, so the entry cannot be taken back. Blank it out
+			 * instead.
+			 */
+			ret = nr;
+			break;
 		}
 
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	if (unlikely(ret < 0)) {
+		size_t done = 0;
+
+		while (done < header.len) {
+			static const char zeroes[64];
+			size_t len = min_t(size_t, header.len - done,
+					   sizeof(zeroes));
+
+			do_write_log(log, pos + done, zeroes, len);
+			done += len;
+		}
+	}
+
+	commit_entry(log, off);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
@@ -409,12 +571,9 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_off = ACCESS_ONCE(log->head);
+		reader->mode = LOGGER_READ_SINGLE;
 
 		file->private_data = reader;
 	} else
@@ -432,7 +591,6 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
 		kfree(reader);
 	}
 
@@ -462,10 +620,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (fix_up_reader(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -473,54 +631,97 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
-	struct logger_reader *reader;
+	struct logger_reader *reader = NULL;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	if (file->f_mode & FMODE_READ) {
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+	}
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
 		break;
 	case LOGGER_GET_LOG_LEN:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		fix_up_reader(log, reader);
+		ret = ACCESS_ONCE(log->c_off) - reader->r_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		do {
+			if (fix_up_reader(log, reader))
+				ret = get_entry_len(log,
+						    logger_offset(reader->r_off));
+			else
+				ret = 0;
+			smp_rmb();
+		} while (unlikely(!reader_valid(log, reader->r_off)));
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers find themselves behind the head and catch up */
+		spin_lock(&log->lock);
+		log->head = log->c_off;
+		log->info->head = log->head;
+		spin_unlock(&log->lock);
+		ret = 0;
+		break;
+	case LOGGER_SET_READ_MODE:
+		if (!reader) {
+			ret = -EBADF;
+			break;
+		}
+		if (arg != LOGGER_READ_SINGLE && arg != LOGGER_READ_BATCH) {
+			ret = -EINVAL;
+			break;
+		}
+		reader->mode = arg;
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	if (reader)
+		mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the page holding the shared struct logger_ring_info, followed by the
+ * ring itself, read-only into the reader. See logger.h for how to consume
+ * entries through the mapping.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	if (vma->vm_pgoff || size != PAGE_SIZE + log->size)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_vmalloc_range(vma, log->info, 0);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
@@ -528,19 +729,19 @@ static const struct file_operations logger_fops = {
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
+	.mmap = logger_mmap,
 	.open = logger_open,
 	.release = logger_release,
 };
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN and PAGE_SIZE,
+ * and less than LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The ring and the page
+ * holding its info are allocated by init_log().
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -548,9 +749,10 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.commit_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .commit_wq), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.c_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -575,12 +777,29 @@ static struct logger_log *get_log_from_minor(int minor)
 
 static int __init init_log(struct logger_log *log)
 {
+	void *mem;
 	int ret;
 
+	/*
+	 * The ring info gets a page of its own, directly in front of the
+	 * ring, so that both can be mapped to user space in one go without
+	 * exposing anything else.
+	 */
+	mem = vmalloc_user(PAGE_SIZE + log->size);
+	if (unlikely(!mem)) {
+		printk(KERN_ERR "logger: failed to allocate log '%s'!\n",
+		       log->misc.name);
+		return -ENOMEM;
+	}
+	log->info = mem;
+	log->info->size = log->size;
+	log->buffer = mem + PAGE_SIZE;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+		vfree(mem);
 		return ret;
 	}
 
@@ -30,6 +30,24 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * struct logger_ring_info - the first page of an mmap() of a log device
+ *
+ * The ring of entries follows it, starting one page into the mapping, and
+ * a mapping has to cover exactly the info page and the whole ring.
+ * 'head' and 'tail' are free running byte positions, the entry at position
+ * 'pos' starts at byte 'pos & (size - 1)' of the ring and may wrap around
+ * its end. Everything in [head, tail) is readable. A consumer keeps its own
+ * position, reads 'tail', issues a read barrier, copies entries out and
+ * then checks 'head' again: if it has moved past the copied entries, a
+ * writer overwrote them and the consumer must restart at 'head'.
+ */
+struct logger_ring_info {
+	__u32		head;	/* oldest entry still in the ring */
+	__u32		tail;	/* end of the last committed entry */
+	__u32		size;	/* size of the ring in bytes */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -45,5 +63,10 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 5) /* set read mode */
+
+/* arguments of LOGGER_SET_READ_MODE */
+#define LOGGER_READ_SINGLE	0	/* one entry per read() (default) */
+#define LOGGER_READ_BATCH	1	/* as many entries as fit per read() */
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,14 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Reading /dev/lowmem_pressure returns the number of minfree levels the free
+ * memory is currently below, 0 meaning none. The file polls readable
+ * whenever that number has changed since it was last read.
+ *
+ * Setting /sys/module/lowmemorykiller/parameters/kill_ahead to N makes every
+ * kill also take out up to N further candidates, so that a burst allocation
+ * does not have to wait for memory to be freed one process at a time.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +43,10 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,9 +64,37 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
-static struct task_struct *lowmem_deathpending;
+#define LOWMEM_KILL_AHEAD_MAX	4
+
+static int lowmem_kill_ahead;
+static struct task_struct *lowmem_deathpending[LOWMEM_KILL_AHEAD_MAX + 1];
 static unsigned long lowmem_deathpending_timeout;
 
+/* Updated from the shrinker and from task free, which may run in softirq */
+static int lowmem_pressure;
+static unsigned int lowmem_pressure_seq;
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+/*
+ * Candidate index: every thread group on the system sits in the bucket for
+ * its oom_adj, so the shrinker only has to look at the groups in the highest
+ * nonempty bucket it is allowed to kill from instead of at every process.
+ * Groups are added on fork, removed when they are reaped and moved when
+ * their oom_adj is written. RSS changes with every fault and is therefore
+ * not indexed; it is only compared among the groups in one bucket.
+ *
+ * Buckets are protected by lowmem_index_lock, which nests inside siglock
+ * and so must be taken with interrupts disabled. Adding and removing groups
+ * also happens under the write side of tasklist_lock, so the shrinker
+ * holding it for reading can use the groups' threads.
+ */
+#define LOWMEM_INDEX_SIZE	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct list_head lowmem_index[LOWMEM_INDEX_SIZE];
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static int lowmem_index_ready;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -68,28 +108,151 @@ static struct notifier_block task_nb = {
 	.notifier_call	= task_notify_func,
 };
 
+static void lowmem_set_pressure(int level)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_pressure_lock, flags);
+	if (level == lowmem_pressure) {
+		spin_unlock_irqrestore(&lowmem_pressure_lock, flags);
+		return;
+	}
+	lowmem_pressure = level;
+	lowmem_pressure_seq++;
+	spin_unlock_irqrestore(&lowmem_pressure_lock, flags);
+
+	wake_up_interruptible(&lowmem_pressure_wait);
+}
+
+/*
+ * lowmem_min_adj - returns the lowest oom_adj we may kill at the given
+ * amount of free memory, or OOM_ADJUST_MAX + 1 if there is no need to kill
+ * anything, and updates the pressure level.
+ */
+static int lowmem_min_adj(int other_free, int other_file)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int min_adj = OOM_ADJUST_MAX + 1;
+	int level = 0;
+	int i;
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i]) {
+			min_adj = lowmem_adj[i];
+			level = array_size - i;
+			break;
+		}
+	}
+	lowmem_set_pressure(level);
+
+	return min_adj;
+}
+
+static int lowmem_death_outstanding(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lowmem_deathpending); i++)
+		if (lowmem_deathpending[i])
+			return 1;
+	return 0;
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
+	int i;
 
-	if (task == lowmem_deathpending)
-		lowmem_deathpending = NULL;
+	for (i = 0; i < ARRAY_SIZE(lowmem_deathpending); i++) {
+		if (task != lowmem_deathpending[i])
+			continue;
+		lowmem_deathpending[i] = NULL;
+
+		/* its memory is back, let the listeners know */
+		lowmem_min_adj(global_page_state(NR_FREE_PAGES),
+			       global_page_state(NR_FILE_PAGES) -
+			       global_page_state(NR_SHMEM));
+	}
 
 	return NOTIFY_OK;
 }
 
+static inline struct list_head *lowmem_bucket(int oom_adj)
+{
+	return &lowmem_index[oom_adj - OOM_DISABLE];
+}
+
+/* Called with tasklist_lock held for writing. */
+void lowmem_index_add(struct signal_struct *sig)
+{
+	if (!lowmem_index_ready)
+		return;
+
+	spin_lock(&lowmem_index_lock);
+	list_add_tail(&sig->oom_adj_node, lowmem_bucket(sig->oom_adj));
+	spin_unlock(&lowmem_index_lock);
+}
+
+/* Called with tasklist_lock held for writing. */
+void lowmem_index_del(struct signal_struct *sig)
+{
+	if (!lowmem_index_ready)
+		return;
+
+	spin_lock(&lowmem_index_lock);
+	list_del_init(&sig->oom_adj_node);
+	spin_unlock(&lowmem_index_lock);
+}
+
+/* Called with the group's siglock held, after oom_adj has changed. */
+void lowmem_index_update(struct signal_struct *sig)
+{
+	spin_lock(&lowmem_index_lock);
+	if (!list_empty(&sig->oom_adj_node))
+		list_move_tail(&sig->oom_adj_node, lowmem_bucket(sig->oom_adj));
+	spin_unlock(&lowmem_index_lock);
+}
+
+/*
+ * lowmem_lock_group_mm - returns a thread of the group 'sig' that still has
+ * its mm, with task_lock() held, or NULL if all of them have let go of it.
+ *
+ * Caller needs to hold tasklist_lock.
+ */
+static struct task_struct *lowmem_lock_group_mm(struct signal_struct *sig)
+{
+	struct task_struct *p = sig->curr_target, *t = p;
+
+	do {
+		task_lock(t);
+		if (t->mm)
+			return t;
+		task_unlock(t);
+	} while_each_thread(p, t);
+
+	return NULL;
+}
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
-	struct task_struct *selected = NULL;
+	struct task_struct *selected[LOWMEM_KILL_AHEAD_MAX + 1];
+	struct signal_struct *sig;
 	int rem = 0;
 	int tasksize;
+	int oom_adj;
 	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int min_adj;
+	int selected_tasksize[LOWMEM_KILL_AHEAD_MAX + 1];
+	int selected_oom_adj[LOWMEM_KILL_AHEAD_MAX + 1];
+	int nr_selected = 0;
+	int max_selected = 1 + clamp(lowmem_kill_ahead, 0, LOWMEM_KILL_AHEAD_MAX);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
@@ -101,21 +264,14 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
+	if (lowmem_death_outstanding() &&
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	min_adj = lowmem_min_adj(other_free, other_file);
+	/* lowmem_adj is set from userspace, stay inside the index */
+	if (min_adj < OOM_DISABLE)
+		min_adj = OOM_DISABLE;
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
 			     nr_to_scan, gfp_mask, other_free, other_file,
@@ -129,52 +285,62 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
 
+	/*
+	 * Collect the 'max_selected' best victims, highest oom_adj first and
+	 * the largest within one oom_adj. Buckets are visited in that order,
+	 * so once we have enough the lower ones cannot contribute anymore.
+	 */
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+	spin_lock_irq(&lowmem_index_lock);
+	for (oom_adj = OOM_ADJUST_MAX;
+	     oom_adj >= min_adj && nr_selected < max_selected; oom_adj--) {
+		list_for_each_entry(sig, lowmem_bucket(oom_adj), oom_adj_node) {
+			p = lowmem_lock_group_mm(sig);
+			if (!p)
+				continue;
+			tasksize = get_mm_rss(p->mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+
+			i = nr_selected;
+			while (i > 0 && selected_oom_adj[i - 1] == oom_adj &&
+			       selected_tasksize[i - 1] < tasksize)
+				i--;
+			if (i >= max_selected)
 				continue;
+			if (nr_selected < max_selected)
+				nr_selected++;
+			memmove(&selected[i + 1], &selected[i],
+				(nr_selected - i - 1) * sizeof(selected[0]));
+			memmove(&selected_tasksize[i + 1], &selected_tasksize[i],
+				(nr_selected - i - 1) * sizeof(int));
+			memmove(&selected_oom_adj[i + 1], &selected_oom_adj[i],
+				(nr_selected - i - 1) * sizeof(int));
+			selected[i] = p;
+			selected_tasksize[i] = tasksize;
+			selected_oom_adj[i] = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->tgid, p->comm, oom_adj,
+				     tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
-	if (selected) {
+	spin_unlock_irq(&lowmem_index_lock);
+	for (i = 0; i < ARRAY_SIZE(lowmem_deathpending); i++) {
+		if (i >= nr_selected) {
+			lowmem_deathpending[i] = NULL;
+			continue;
+		}
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+			     selected[i]->tgid, selected[i]->comm,
+			     selected_oom_adj[i], selected_tasksize[i]);
+		lowmem_deathpending[i] = selected[i];
+		force_sig(SIGKILL, selected[i]);
+		rem -= selected_tasksize[i];
 	}
+	if (nr_selected)
+		lowmem_deathpending_timeout = jiffies + HZ;
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
 		     nr_to_scan, gfp_mask, rem);
 	read_unlock(&tasklist_lock);
@@ -186,15 +352,81 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+/*
+ * Each open file remembers the pressure change it has last seen in
+ * private_data, so poll only reports changes the reader has not read yet.
+ */
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)(unsigned long)lowmem_pressure_seq;
+	return 0;
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	char tmp[16];
+	int len;
+	int level;
+
+	spin_lock_irq(&lowmem_pressure_lock);
+	file->private_data = (void *)(unsigned long)lowmem_pressure_seq;
+	level = lowmem_pressure;
+	spin_unlock_irq(&lowmem_pressure_lock);
+	len = snprintf(tmp, sizeof(tmp), "%d\n", level);
+
+	return simple_read_from_buffer(buf, count, ppos, tmp, len);
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_pressure_wait, wait);
+
+	if ((unsigned long)file->private_data != lowmem_pressure_seq)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.read = lowmem_pressure_read,
+	.poll = lowmem_pressure_poll,
+	.llseek = default_llseek,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmem_pressure",
+	.fops = &lowmem_pressure_fops,
+};
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_INDEX_SIZE; i++)
+		INIT_LIST_HEAD(&lowmem_index[i]);
+
+	/* index everything forked before us */
+	write_lock_irq(&tasklist_lock);
+	lowmem_index_ready = 1;
+	for_each_process(p)
+		lowmem_index_add(p->signal);
+	write_unlock_irq(&tasklist_lock);
+
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_pressure_misc))
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "pressure device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	misc_deregister(&lowmem_pressure_misc);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 }
@@ -205,6 +437,7 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(kill_ahead, lowmem_kill_ahead, int, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -23,8 +23,8 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
@@ -35,9 +35,12 @@
 /* Globals */
 static int ramzswap_major;
 static struct ramzswap *devices;
+static struct kmem_cache *dedup_cache;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
+static unsigned int num_streams;
+static char *compressor = "lzo";
 
 static int rzs_test_flag(struct ramzswap *rzs, u32 index,
 			enum rzs_pageflags flag)
@@ -72,6 +75,292 @@ static int page_zero_filled(void *ptr)
 	return 1;
 }
 
+static void rzs_free_streams(struct ramzswap *rzs)
+{
+	struct rzs_stream *stream, *next;
+
+	list_for_each_entry_safe(stream, next, &rzs->idle_streams, list) {
+		list_del(&stream->list);
+		if (!IS_ERR_OR_NULL(stream->tfm))
+			crypto_free_comp(stream->tfm);
+		free_pages((unsigned long)stream->buffer, 1);
+		kfree(stream);
+	}
+	rzs->num_streams = 0;
+}
+
+static const char *rzs_compressor(struct ramzswap *rzs)
+{
+	return rzs->compressor[0] ? rzs->compressor : compressor;
+}
+
+static int rzs_alloc_streams(struct ramzswap *rzs, unsigned int count)
+{
+	int ret;
+	struct rzs_stream *stream;
+
+	while (rzs->num_streams < count) {
+		stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+		if (!stream)
+			return -ENOMEM;
+
+		stream->tfm = crypto_alloc_comp(rzs_compressor(rzs), 0, 0);
+		if (IS_ERR(stream->tfm)) {
+			ret = PTR_ERR(stream->tfm);
+			kfree(stream);
+			return ret;
+		}
+
+		stream->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!stream->buffer) {
+			crypto_free_comp(stream->tfm);
+			kfree(stream);
+			return -ENOMEM;
+		}
+
+		list_add(&stream->list, &rzs->idle_streams);
+		rzs->num_streams++;
+	}
+
+	return 0;
+}
+
+/*
+ * Takes an idle compression stream, waiting for another reader or writer
+ * to put one back if they are all busy.
+ */
+static struct rzs_stream *rzs_stream_get(struct ramzswap *rzs)
+{
+	struct rzs_stream *stream;
+
+	for (;;) {
+		spin_lock(&rzs->stream_lock);
+		if (!list_empty(&rzs->idle_streams)) {
+			stream = list_first_entry(&rzs->idle_streams,
+						  struct rzs_stream, list);
+			list_del(&stream->list);
+			spin_unlock(&rzs->stream_lock);
+			return stream;
+		}
+		spin_unlock(&rzs->stream_lock);
+
+		wait_event(rzs->stream_wait,
+			   !list_empty(&rzs->idle_streams));
+	}
+}
+
+static void rzs_stream_put(struct ramzswap *rzs, struct rzs_stream *stream)
+{
+	spin_lock(&rzs->stream_lock);
+	list_add(&stream->list, &rzs->idle_streams);
+	spin_unlock(&rzs->stream_lock);
+
+	smp_mb();
+	if (waitqueue_active(&rzs->stream_wait))
+		wake_up(&rzs->stream_wait);
+}
+
+/*
+ * Allocates a page on the backing device. Returns 0 if it is full.
+ */
+static unsigned long rzs_backing_alloc(struct ramzswap *rzs)
+{
+	unsigned long slot;
+
+	spin_lock(&rzs->backing_lock);
+	slot = find_next_zero_bit(rzs->backing_map, rzs->backing_pages,
+				  rzs->backing_cursor);
+	if (slot >= rzs->backing_pages)
+		slot = find_next_zero_bit(rzs->backing_map,
+					  rzs->backing_pages, 1);
+	if (slot < rzs->backing_pages) {
+		__set_bit(slot, rzs->backing_map);
+		rzs->backing_cursor = slot + 1;
+	} else {
+		slot = 0;
+	}
+	spin_unlock(&rzs->backing_lock);
+
+	return slot;
+}
+
+static void rzs_backing_free(struct ramzswap *rzs, unsigned long slot)
+{
+	spin_lock(&rzs->backing_lock);
+	__clear_bit(slot, rzs->backing_map);
+	spin_unlock(&rzs->backing_lock);
+}
+
+static void rzs_put_backing_dev(struct ramzswap *rzs)
+{
+	if (!rzs->backing_bdev)
+		return;
+
+	close_bdev_exclusive(rzs->backing_bdev, FMODE_READ | FMODE_WRITE);
+	rzs->backing_bdev = NULL;
+
+	vfree(rzs->backing_map);
+	rzs->backing_map = NULL;
+	rzs->backing_pages = 0;
+	rzs->backing_cursor = 0;
+}
+
+static int rzs_set_backing_dev(struct ramzswap *rzs, const char *path)
+{
+	int ret;
+	size_t map_size;
+	unsigned long nr_pages;
+	struct block_device *bdev;
+
+	bdev = open_bdev_exclusive(path, FMODE_READ | FMODE_WRITE, rzs);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	map_size = BITS_TO_LONGS(nr_pages) * sizeof(long);
+	rzs_put_backing_dev(rzs);
+	rzs->backing_map = vmalloc(map_size);
+	if (!rzs->backing_map) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(rzs->backing_map, 0, map_size);
+	__set_bit(0, rzs->backing_map);
+
+	rzs->backing_bdev = bdev;
+	rzs->backing_pages = nr_pages;
+	rzs->backing_cursor = 1;
+
+	pr_info("Backing device set to %s (%lu kB)\n", path,
+		nr_pages << (PAGE_SHIFT - 10));
+	return 0;
+
+fail:
+	close_bdev_exclusive(bdev, FMODE_READ | FMODE_WRITE);
+	return ret;
+}
+
+static u32 rzs_dedup_hash(const void *cmem, unsigned int clen)
+{
+	return jhash(cmem, clen, 0);
+}
+
+/*
+ * Looks for a stored object with the same compressed data and, if there
+ * is one, makes the table entry for @index share it.
+ * Called with rzs->lock held.
+ */
+static int rzs_dedup_find(struct ramzswap *rzs, u32 index, const void *src,
+			unsigned int clen, u32 hash)
+{
+	int found = 0;
+	struct rzs_dedup *dd;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(dd, pos,
+			&rzs->dedup_table[hash & rzs->dedup_mask], node) {
+		if (dd->hash != hash || dd->clen != clen)
+			continue;
+
+		cmem = kmap_atomic(dd->page, KM_USER1) + dd->offset;
+		found = !memcmp(cmem + sizeof(struct zobj_header), src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		if (!found)
+			continue;
+
+		dd->refcount++;
+		rzs->table[index].page = dd->page;
+		rzs->table[index].offset = dd->offset;
+		rzs->table[index].hash = hash;
+		rzs_stat64_inc(rzs, &rzs->stats.pages_dedup);
+		break;
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return found;
+}
+
+/*
+ * Indexes a newly stored object. Failing to allocate the index entry is
+ * harmless: the object just cannot be shared.
+ */
+static void rzs_dedup_add(struct ramzswap *rzs, u32 index,
+			unsigned int clen, u32 hash)
+{
+	struct rzs_dedup *dd;
+
+	dd = kmem_cache_alloc(dedup_cache, GFP_NOIO);
+	if (!dd)
+		return;
+
+	dd->page = rzs->table[index].page;
+	dd->offset = rzs->table[index].offset;
+	dd->clen = clen;
+	dd->hash = hash;
+	dd->refcount = 1;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_add_head(&dd->node, &rzs->dedup_table[hash & rzs->dedup_mask]);
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/*
+ * Finds the index entry of the object at @page/@offset, if it has one.
+ * Called with rzs->dedup_lock held.
+ */
+static struct rzs_dedup *rzs_dedup_lookup(struct ramzswap *rzs, u32 hash,
+			struct page *page, u16 offset)
+{
+	struct rzs_dedup *dd;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(dd, pos,
+			&rzs->dedup_table[hash & rzs->dedup_mask], node) {
+		if (dd->page == page && dd->offset == offset)
+			return dd;
+	}
+
+	return NULL;
+}
+
+/*
+ * Drops the reference a table entry holds on the object at @page/@offset,
+ * whose dedup hash is @hash. Returns 1 if other entries still use it.
+ */
+static int rzs_dedup_put(struct ramzswap *rzs, struct page *page, u16 offset,
+			u32 hash)
+{
+	struct rzs_dedup *dd;
+
+	if (!rzs->dedup_table)
+		return 0;
+
+	spin_lock(&rzs->dedup_lock);
+	dd = rzs_dedup_lookup(rzs, hash, page, offset);
+	if (!dd) {
+		spin_unlock(&rzs->dedup_lock);
+		return 0;
+	}
+
+	if (--dd->refcount) {
+		rzs_stat64_dec(rzs, &rzs->stats.pages_dedup);
+		spin_unlock(&rzs->dedup_lock);
+		return 1;
+	}
+
+	hlist_del(&dd->node);
+	spin_unlock(&rzs->dedup_lock);
+	kmem_cache_free(dedup_cache, dd);
+	return 0;
+}
+
 static void ramzswap_set_disksize(struct ramzswap *rzs, size_t totalram_bytes)
 {
 	if (!rzs->disksize) {
@@ -123,6 +412,7 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 #if defined(CONFIG_RAMZSWAP_STATS)
 	{
 	struct ramzswap_stats *rs = &rzs->stats;
+	struct xv_pool_stats ps;
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
 
@@ -154,6 +444,29 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
 	s->compr_data_size = rs->compr_size;
 	s->mem_used_total = mem_used;
+
+	strlcpy(s->compressor, rzs_compressor(rzs), sizeof(s->compressor));
+	if (rs->pages_stored)
+		s->compr_ratio_pct = div64_u64(s->compr_data_size * 100,
+					       s->orig_data_size);
+	s->num_compress = rzs_stat64_read(rzs, &rs->num_compress);
+	s->compress_ns = rzs_stat64_read(rzs, &rs->compress_ns);
+	s->num_decompress = rzs_stat64_read(rzs, &rs->num_decompress);
+	s->decompress_ns = rzs_stat64_read(rzs, &rs->decompress_ns);
+	s->pages_dedup = rzs_stat64_read(rzs, &rs->pages_dedup);
+	s->num_dedup_hits = rzs_stat64_read(rzs, &rs->dedup_hits);
+
+	xv_get_pool_stats(rzs->mem_pool, &ps);
+	BUILD_BUG_ON(RZS_NR_FILL_CLASSES != XV_NR_FILL_CLASSES);
+	s->pool_used_bytes = ps.used_bytes;
+	memcpy(s->pool_pages_by_fill, ps.pages_by_fill,
+		sizeof(s->pool_pages_by_fill));
+	s->num_compactions = rzs_stat64_read(rzs, &rs->num_compactions);
+	s->compact_moved = rzs_stat64_read(rzs, &rs->compact_moved);
+	s->compact_freed_pages = ps.compacted_pages;
+	s->pages_backed = rs->pages_backed;
+	s->bd_writes = rzs_stat64_read(rzs, &rs->bd_writes);
+	s->bd_reads = rzs_stat64_read(rzs, &rs->bd_reads);
 	}
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
@@ -161,11 +474,23 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
 	u32 clen;
+	int shared;
 	void *obj;
 
 	struct page *page = rzs->table[index].page;
 	u32 offset = rzs->table[index].offset;
 
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+	rzs_clear_flag(rzs, index, RZS_WB);
+
+	if (unlikely(rzs_test_flag(rzs, index, RZS_BACKED))) {
+		rzs_backing_free(rzs, rzs->table[index].backing);
+		rzs_clear_flag(rzs, index, RZS_BACKED);
+		rzs_stat_dec(&rzs->stats.pages_backed);
+		rzs->table[index].backing = 0;
+		return;
+	}
+
 	if (unlikely(!page)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -189,17 +514,36 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 	obj = kmap_atomic(page, KM_USER0) + offset;
 	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
 	kunmap_atomic(obj, KM_USER0);
+	shared = rzs_dedup_put(rzs, page, offset, rzs->table[index].hash);
 
-	xv_free(rzs->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
 
+	/* Another page still uses the object */
+	if (shared)
+		goto out_shared;
+
+	xv_free(rzs->mem_pool, page, offset);
+
 out:
 	rzs->stats.compr_size -= clen;
+out_shared:
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
 	rzs->table[index].page = NULL;
 	rzs->table[index].offset = 0;
+	rzs->table[index].hash = 0;
+}
+
+/*
+ * Swap frees a slot before writing it again, but a plain write to the
+ * device can overwrite a slot that still holds data.
+ */
+static void rzs_free_stale(struct ramzswap *rzs, u32 index)
+{
+	if (unlikely(rzs->table[index].page ||
+		     rzs_test_flag(rzs, index, RZS_ZERO)))
+		ramzswap_free_page(rzs, index);
 }
 
 static int handle_zero_page(struct bio *bio)
@@ -242,6 +586,21 @@ static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
 	return 0;
 }
 
+/*
+ * The page was written back: send the request on to the backing device.
+ */
+static int handle_backed_page(struct ramzswap *rzs, struct bio *bio,
+			unsigned long slot)
+{
+	rzs_stat64_inc(rzs, &rzs->stats.bd_reads);
+
+	bio->bi_bdev = rzs->backing_bdev;
+	bio->bi_sector = (sector_t)slot << SECTORS_PER_PAGE_SHIFT;
+
+	/* Tell generic_make_request() to resubmit the remapped bio */
+	return 1;
+}
+
 /*
  * Called when request page is not present in ramzswap.
  * This is an attempt to read before any previous write
@@ -265,8 +624,10 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
 	u32 index;
-	size_t clen;
+	unsigned int clen;
+	ktime_t start;
 	struct page *page;
+	struct rzs_stream *stream;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem;
 
@@ -278,13 +639,35 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	if (rzs_test_flag(rzs, index, RZS_ZERO))
 		return handle_zero_page(bio);
 
+	stream = rzs_stream_get(rzs);
+
+	/* Writeback may move the page to the backing device meanwhile */
+	read_lock(&rzs->compact_lock);
+
+	if (unlikely(rzs_test_flag(rzs, index, RZS_BACKED))) {
+		unsigned long slot = rzs->table[index].backing;
+
+		read_unlock(&rzs->compact_lock);
+		rzs_stream_put(rzs, stream);
+		return handle_backed_page(rzs, bio, slot);
+	}
+
 	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
+	if (!rzs->table[index].page) {
+		read_unlock(&rzs->compact_lock);
+		rzs_stream_put(rzs, stream);
 		return handle_ramzswap_fault(rzs, bio);
+	}
+
+	rzs_clear_flag(rzs, index, RZS_IDLE);
 
 	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(rzs, bio);
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
+		ret = handle_uncompressed_page(rzs, bio);
+		read_unlock(&rzs->compact_lock);
+		rzs_stream_put(rzs, stream);
+		return ret;
+	}
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	clen = PAGE_SIZE;
@@ -292,22 +675,28 @@ static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
 	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
 			rzs->table[index].offset;
 
-	ret = lzo1x_decompress_safe(
+	start = rzs_clock();
+	ret = crypto_comp_decompress(stream->tfm,
 		cmem + sizeof(*zheader),
 		xv_get_object_size(cmem) - sizeof(*zheader),
 		user_mem, &clen);
 
 	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	read_unlock(&rzs->compact_lock);
+	rzs_stream_put(rzs, stream);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret || clen != PAGE_SIZE)) {
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
 		goto out;
 	}
 
+	rzs_stat64_time(rzs, &rzs->stats.num_decompress,
+			&rzs->stats.decompress_ns, start);
+
 	flush_dcache_page(page);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -322,10 +711,12 @@ out:
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
-	u32 offset, index;
-	size_t clen;
+	u32 offset, index, hash;
+	unsigned int clen;
+	ktime_t start;
 	struct zobj_header *zheader;
 	struct page *page, *page_store;
+	struct rzs_stream *stream;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,33 +724,46 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
-
-	mutex_lock(&rzs->lock);
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		mutex_unlock(&rzs->lock);
+		mutex_lock(&rzs->lock);
+		rzs_free_stale(rzs, index);
 		rzs_stat_inc(&rzs->stats.pages_zero);
 		rzs_set_flag(rzs, index, RZS_ZERO);
+		mutex_unlock(&rzs->lock);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
+	kunmap_atomic(user_mem, KM_USER0);
+
+	/* compress outside of rzs->lock, in parallel with other writers */
+	stream = rzs_stream_get(rzs);
+	src = stream->buffer;
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	clen = 2 * PAGE_SIZE;
 
+	user_mem = kmap_atomic(page, KM_USER0);
+	start = rzs_clock();
+	ret = crypto_comp_compress(stream->tfm, user_mem, PAGE_SIZE,
+				src, &clen);
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		rzs_stream_put(rzs, stream);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
+	rzs_stat64_time(rzs, &rzs->stats.num_compress,
+			&rzs->stats.compress_ns, start);
+
+	hash = rzs_dedup_hash(src, clen);
+
+	mutex_lock(&rzs->lock);
+	rzs_free_stale(rzs, index);
 
 	/*
 	 * Page is incompressible. Store it as-is (uncompressed)
@@ -371,6 +775,7 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
 			mutex_unlock(&rzs->lock);
+			rzs_stream_put(rzs, stream);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
@@ -385,12 +790,19 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		goto memstore;
 	}
 
+	/* Same contents as a page already stored: just share it */
+	if (rzs_dedup_find(rzs, index, src, clen, hash)) {
+		rzs_stat64_inc(rzs, &rzs->stats.dedup_hits);
+		goto update_stats;
+	}
+
 	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
 			&rzs->table[index].page, &offset,
 			GFP_NOIO | __GFP_HIGHMEM)) {
 		mutex_unlock(&rzs->lock);
+		rzs_stream_put(rzs, stream);
 		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+			"page: %u, size=%u\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
@@ -415,14 +827,20 @@ memstore:
 	kunmap_atomic(cmem, KM_USER1);
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
 		kunmap_atomic(src, KM_USER0);
+	else {
+		rzs->table[index].hash = hash;
+		rzs_dedup_add(rzs, index, clen, hash);
+	}
 
-	/* Update stats */
 	rzs->stats.compr_size += clen;
+
+update_stats:
 	rzs_stat_inc(&rzs->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
 
 	mutex_unlock(&rzs->lock);
+	rzs_stream_put(rzs, stream);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
@@ -492,32 +910,29 @@ static void reset_device(struct ramzswap *rzs)
 	rzs->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
-
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
-
-	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
-
-		if (!page)
-			continue;
+	rzs_free_streams(rzs);
 
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
+	/*
+	 * Free all pages that are still in this ramzswap device. Objects
+	 * may be shared, so go through ramzswap_free_page() which keeps
+	 * track of that. The table is not there yet if setting up the
+	 * compression streams failed.
+	 */
+	for (index = 0; rzs->table && index < rzs->disksize >> PAGE_SHIFT;
+	     index++) {
+		if (rzs->table[index].page)
+			ramzswap_free_page(rzs, index);
 	}
 
 	vfree(rzs->table);
 	rzs->table = NULL;
 
+	vfree(rzs->dedup_table);
+	rzs->dedup_table = NULL;
+	rzs->dedup_mask = 0;
+
+	rzs_put_backing_dev(rzs);
+
 	xv_destroy_pool(rzs->mem_pool);
 	rzs->mem_pool = NULL;
 
@@ -525,12 +940,13 @@ static void reset_device(struct ramzswap *rzs)
 	memset(&rzs->stats, 0, sizeof(rzs->stats));
 
 	rzs->disksize = 0;
+	rzs->compressor[0] = '\0';
 }
 
 static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 {
 	int ret;
-	size_t num_pages;
+	size_t num_pages, num_buckets;
 	struct page *page;
 	union swap_header *swap_header;
 
@@ -541,17 +957,11 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = rzs_alloc_streams(rzs, num_streams ? num_streams :
+				     num_online_cpus());
+	if (ret) {
+		pr_err("Error allocating %s compression streams\n",
+			rzs_compressor(rzs));
 		goto fail;
 	}
 
@@ -566,6 +976,17 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 	memset(rzs->table, 0, num_pages * sizeof(*rzs->table));
 
+	/* One dedup bucket for every four pages */
+	num_buckets = roundup_pow_of_two(max_t(size_t, num_pages >> 2, 1));
+	rzs->dedup_table = vmalloc(num_buckets * sizeof(*rzs->dedup_table));
+	if (!rzs->dedup_table) {
+		pr_err("Error allocating ramzswap dedup index\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(rzs->dedup_table, 0, num_buckets * sizeof(*rzs->dedup_table));
+	rzs->dedup_mask = num_buckets - 1;
+
 	page = alloc_page(__GFP_ZERO);
 	if (!page) {
 		pr_err("Error allocating swap header page\n");
@@ -605,20 +1026,417 @@ fail:
 
 static int ramzswap_ioctl_reset_device(struct ramzswap *rzs)
 {
+	mutex_lock(&rzs->wb_lock);
+	mutex_lock(&rzs->lock);
 	if (rzs->init_done)
 		reset_device(rzs);
+	else
+		rzs_put_backing_dev(rzs);
+	mutex_unlock(&rzs->lock);
+	mutex_unlock(&rzs->wb_lock);
 
 	return 0;
 }
 
+/*
+ * Moves the object of table entry @index to another pool page if it
+ * sits in a page isolated for compaction. Objects shared by several
+ * table entries are left alone. Called with rzs->lock held.
+ */
+static int rzs_move_object(struct ramzswap *rzs, u32 index)
+{
+	int ret = 0;
+	u32 size, offset, new_offset;
+	struct page *page, *new_page;
+	struct rzs_dedup *dd;
+	unsigned char *obj, *new_obj;
+
+	write_lock(&rzs->compact_lock);
+
+	page = rzs->table[index].page;
+	offset = rzs->table[index].offset;
+	if (!page || rzs_test_flag(rzs, index, RZS_BACKED) ||
+			rzs_test_flag(rzs, index, RZS_UNCOMPRESSED) ||
+			!xv_page_isolated(page))
+		goto out;
+
+	obj = kmap_atomic(page, KM_USER0) + offset;
+	size = xv_get_object_size(obj);
+	kunmap_atomic(obj, KM_USER0);
+
+	spin_lock(&rzs->dedup_lock);
+	dd = rzs_dedup_lookup(rzs, rzs->table[index].hash, page, offset);
+	if (dd && dd->refcount > 1)
+		goto out_unlock;
+
+	/* Never grow the pool: the object has to fit in free space */
+	ret = xv_malloc(rzs->mem_pool, size, &new_page, &new_offset,
+			GFP_NOWAIT);
+	if (ret)
+		goto out_unlock;
+
+	obj = kmap_atomic(page, KM_USER0) + offset;
+	new_obj = kmap_atomic(new_page, KM_USER1) + new_offset;
+	memcpy(new_obj, obj, size);
+	kunmap_atomic(obj, KM_USER0);
+	kunmap_atomic(new_obj, KM_USER1);
+
+	if (dd) {
+		dd->page = new_page;
+		dd->offset = new_offset;
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	rzs->table[index].page = new_page;
+	rzs->table[index].offset = new_offset;
+	xv_free(rzs->mem_pool, page, offset);
+	rzs_stat64_inc(rzs, &rzs->stats.compact_moved);
+	goto out;
+
+out_unlock:
+	spin_unlock(&rzs->dedup_lock);
+out:
+	write_unlock(&rzs->compact_lock);
+	return ret;
+}
+
+/*
+ * Empties up to @max_pages sparsely used pool pages by moving their
+ * objects into the free space of other pages. Called with rzs->lock held.
+ */
+static void rzs_compact(struct ramzswap *rzs, u32 max_pages)
+{
+	size_t index;
+
+	if (!xv_isolate_sparse_pages(rzs->mem_pool, max_pages))
+		return;
+
+	rzs_stat64_inc(rzs, &rzs->stats.num_compactions);
+
+	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
+		if (!xv_get_isolated_pages(rzs->mem_pool))
+			break;
+		if (rzs_move_object(rzs, index))
+			break;
+		if (index % compact_batch == compact_batch - 1)
+			cond_resched();
+	}
+
+	xv_putback_pages(rzs->mem_pool);
+}
+
+/*
+ * Marks all stored pages idle. Reads clear the mark again, so the pages
+ * still marked at the next RZSIO_WRITEBACK are the cold ones.
+ */
+static void rzs_mark_idle(struct ramzswap *rzs)
+{
+	size_t index;
+
+	mutex_lock(&rzs->lock);
+	write_lock(&rzs->compact_lock);
+	for (index = 1; index < rzs->disksize >> PAGE_SHIFT; index++) {
+		if (rzs->table[index].page &&
+		    !rzs_test_flag(rzs, index, RZS_BACKED))
+			rzs_set_flag(rzs, index, RZS_IDLE);
+
+		if (index % compact_batch == 0) {
+			write_unlock(&rzs->compact_lock);
+			cond_resched();
+			write_lock(&rzs->compact_lock);
+		}
+	}
+	write_unlock(&rzs->compact_lock);
+	mutex_unlock(&rzs->lock);
+}
+
+struct rzs_wb_batch {
+	unsigned int count;
+	u32 index[WB_BATCH];
+	unsigned long slot[WB_BATCH];
+	struct page *page[WB_BATCH];
+
+	atomic_t pending;	/* bios in flight, plus one for the submitter */
+	struct completion done;
+	int error;
+};
+
+static int rzs_wb_candidate(struct ramzswap *rzs, u32 index,
+			unsigned long mode)
+{
+	if (!rzs->table[index].page ||
+	    rzs_test_flag(rzs, index, RZS_BACKED) ||
+	    rzs_test_flag(rzs, index, RZS_WB))
+		return 0;
+
+	return ((mode & RZS_WB_HUGE) &&
+		rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) ||
+	       ((mode & RZS_WB_IDLE) &&
+		rzs_test_flag(rzs, index, RZS_IDLE));
+}
+
+/*
+ * Copies the contents of table entry @index into @page, decompressing
+ * them if needed. Called with rzs->compact_lock held for write.
+ */
+static int rzs_wb_fill(struct ramzswap *rzs, struct rzs_stream *stream,
+			u32 index, struct page *page)
+{
+	int ret = 0;
+	unsigned int clen = PAGE_SIZE;
+	unsigned char *dst, *cmem;
+
+	dst = kmap_atomic(page, KM_USER0);
+	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
+			rzs->table[index].offset;
+
+	if (rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))
+		memcpy(dst, cmem, PAGE_SIZE);
+	else
+		ret = crypto_comp_decompress(stream->tfm,
+			cmem + sizeof(struct zobj_header),
+			xv_get_object_size(cmem) - sizeof(struct zobj_header),
+			dst, &clen);
+
+	kunmap_atomic(dst, KM_USER0);
+	kunmap_atomic(cmem, KM_USER1);
+
+	return ret ? ret : (clen == PAGE_SIZE ? 0 : -EIO);
+}
+
+static void rzs_wb_end_io(struct bio *bio, int error)
+{
+	struct rzs_wb_batch *wb = bio->bi_private;
+
+	if (error)
+		wb->error = error;
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&wb->pending))
+		complete(&wb->done);
+}
+
+/*
+ * Writes the pages of a batch, merging consecutive backing pages into
+ * one bio, and waits for the I/O to finish.
+ */
+static void rzs_wb_submit(struct ramzswap *rzs, struct rzs_wb_batch *wb)
+{
+	unsigned int i;
+	struct bio *bio = NULL;
+
+	atomic_set(&wb->pending, 1);
+	init_completion(&wb->done);
+	wb->error = 0;
+
+	for (i = 0; i < wb->count; i++) {
+		if (bio && (wb->slot[i] != wb->slot[i - 1] + 1 ||
+			    !bio_add_page(bio, wb->page[i], PAGE_SIZE, 0))) {
+			submit_bio(WRITE, bio);
+			bio = NULL;
+		}
+		if (bio)
+			continue;
+
+		bio = bio_alloc(GFP_NOIO, WB_BATCH);
+		bio->bi_bdev = rzs->backing_bdev;
+		bio->bi_sector = (sector_t)wb->slot[i] << SECTORS_PER_PAGE_SHIFT;
+		bio->bi_end_io = rzs_wb_end_io;
+		bio->bi_private = wb;
+		atomic_inc(&wb->pending);
+		if (!bio_add_page(bio, wb->page[i], PAGE_SIZE, 0)) {
+			wb->error = -EIO;
+			bio_put(bio);
+			atomic_dec(&wb->pending);
+			bio = NULL;
+			break;
+		}
+	}
+	if (bio)
+		submit_bio(WRITE, bio);
+
+	if (!atomic_dec_and_test(&wb->pending))
+		wait_for_completion(&wb->done);
+}
+
+/*
+ * Once the batch is on disk, frees the in-memory copies of the pages
+ * that were neither freed nor rewritten in the meantime.
+ */
+static void rzs_wb_commit(struct ramzswap *rzs, struct rzs_wb_batch *wb)
+{
+	unsigned int i;
+	u32 index;
+
+	mutex_lock(&rzs->lock);
+	write_lock(&rzs->compact_lock);
+	for (i = 0; i < wb->count; i++) {
+		index = wb->index[i];
+		if (wb->error || !rzs_test_flag(rzs, index, RZS_WB)) {
+			rzs_clear_flag(rzs, index, RZS_WB);
+			rzs_backing_free(rzs, wb->slot[i]);
+			continue;
+		}
+
+		ramzswap_free_page(rzs, index);
+		rzs->table[index].backing = wb->slot[i];
+		rzs_set_flag(rzs, index, RZS_BACKED);
+		rzs_stat_inc(&rzs->stats.pages_backed);
+		rzs_stat64_inc(rzs, &rzs->stats.bd_writes);
+	}
+	write_unlock(&rzs->compact_lock);
+	mutex_unlock(&rzs->lock);
+
+	for (i = 0; i < wb->count; i++)
+		__free_page(wb->page[i]);
+	wb->count = 0;
+}
+
+/*
+ * Moves the pages selected by @mode (RZS_WB_* flags) to the backing
+ * device, WB_BATCH pages at a time. Pages stay readable from memory
+ * until their batch is written.
+ */
+static int rzs_writeback(struct ramzswap *rzs, unsigned long mode)
+{
+	int ret = 0;
+	u32 index = 1;
+	unsigned long slot;
+	struct page *page;
+	struct rzs_stream *stream;
+	struct rzs_wb_batch *wb;
+
+	wb = kzalloc(sizeof(*wb), GFP_KERNEL);
+	if (!wb)
+		return -ENOMEM;
+
+	while (!ret && index < rzs->disksize >> PAGE_SHIFT) {
+		/* Taking a stream under rzs->lock could deadlock writers */
+		stream = rzs_stream_get(rzs);
+		mutex_lock(&rzs->lock);
+
+		for (; index < rzs->disksize >> PAGE_SHIFT &&
+		       wb->count < WB_BATCH; index++) {
+			/* Unlocked peek, checked again below */
+			if (!rzs_wb_candidate(rzs, index, mode))
+				continue;
+
+			page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+			if (!page) {
+				ret = -ENOMEM;
+				break;
+			}
+			slot = rzs_backing_alloc(rzs);
+			if (!slot) {
+				__free_page(page);
+				ret = -ENOSPC;
+				break;
+			}
+
+			write_lock(&rzs->compact_lock);
+			if (!rzs_wb_candidate(rzs, index, mode) ||
+			    rzs_wb_fill(rzs, stream, index, page)) {
+				write_unlock(&rzs->compact_lock);
+				rzs_backing_free(rzs, slot);
+				__free_page(page);
+				continue;
+			}
+			rzs_set_flag(rzs, index, RZS_WB);
+			write_unlock(&rzs->compact_lock);
+
+			wb->index[wb->count] = index;
+			wb->slot[wb->count] = slot;
+			wb->page[wb->count] = page;
+			wb->count++;
+		}
+
+		mutex_unlock(&rzs->lock);
+		rzs_stream_put(rzs, stream);
+
+		if (wb->count) {
+			rzs_wb_submit(rzs, wb);
+			if (wb->error)
+				ret = wb->error;
+			rzs_wb_commit(rzs, wb);
+		}
+
+		cond_resched();
+	}
+
+	kfree(wb);
+	return ret;
+}
+
+/*
+ * Pool pages compaction could free: all pages minus those needed to hold
+ * the objects if they were packed. Called with rzs->lock held.
+ */
+static u32 rzs_compactable_pages(struct ramzswap *rzs)
+{
+	u64 waste;
+	struct xv_pool_stats ps;
+
+	xv_get_pool_stats(rzs->mem_pool, &ps);
+	waste = ps.total_pages - DIV_ROUND_UP(ps.used_bytes, PAGE_SIZE);
+	if (waste < ps.total_pages >> compact_waste_shift)
+		return 0;
+
+	return waste;
+}
+
+/*
+ * Compacts the memory pools under memory pressure. A writer allocating
+ * memory may get here while it holds its device lock, so devices that
+ * are busy are skipped.
+ */
+static int ramzswap_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	int i, count = 0;
+	struct ramzswap *rzs;
+
+	for (i = 0; i < num_devices; i++) {
+		rzs = &devices[i];
+
+		if (!mutex_trylock(&rzs->lock))
+			continue;
+		if (rzs->init_done) {
+			if (nr_to_scan)
+				rzs_compact(rzs, nr_to_scan);
+			count += rzs_compactable_pages(rzs);
+		}
+		mutex_unlock(&rzs->lock);
+	}
+
+	return count;
+}
+
+static struct shrinker ramzswap_shrinker = {
+	.shrink = ramzswap_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 			unsigned int cmd, unsigned long arg)
 {
 	int ret = 0;
 	size_t disksize_kb;
+	size_t stats_size = sizeof(struct ramzswap_ioctl_stats);
+	char name[RZS_MAX_COMPRESSOR_NAME];
 
 	struct ramzswap *rzs = bdev->bd_disk->private_data;
 
+	/*
+	 * Tools built before the per backend stats were added ask for the
+	 * original, smaller structure: give them just that part.
+	 */
+	if (_IOC_TYPE(cmd) == _IOC_TYPE(RZSIO_GET_STATS) &&
+	    _IOC_NR(cmd) == _IOC_NR(RZSIO_GET_STATS) &&
+	    _IOC_DIR(cmd) == _IOC_READ &&
+	    _IOC_SIZE(cmd) < stats_size) {
+		stats_size = _IOC_SIZE(cmd);
+		cmd = RZSIO_GET_STATS;
+	}
+
 	switch (cmd) {
 	case RZSIO_SET_DISKSIZE_KB:
 		if (rzs->init_done) {
@@ -647,7 +1465,7 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 			goto out;
 		}
 		ramzswap_ioctl_get_stats(rzs, stats);
-		if (copy_to_user((void *)arg, stats, sizeof(*stats))) {
+		if (copy_to_user((void *)arg, stats, stats_size)) {
 			kfree(stats);
 			ret = -EFAULT;
 			goto out;
@@ -655,6 +1473,69 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		kfree(stats);
 		break;
 	}
+	case RZSIO_SET_COMPRESSOR:
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (strncpy_from_user(name, (char __user *)arg,
+				      sizeof(name)) < 0) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		if (!crypto_has_comp(name, 0, 0)) {
+			pr_info("Compressor %s not available\n", name);
+			ret = -EINVAL;
+			goto out;
+		}
+		strcpy(rzs->compressor, name);
+		pr_info("Compressor set to %s\n", name);
+		break;
+
+	case RZSIO_SET_BACKING_DEV:
+	{
+		char path[RZS_MAX_BACKING_NAME];
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (strncpy_from_user(path, (char __user *)arg,
+				      sizeof(path)) < 0) {
+			ret = -EFAULT;
+			goto out;
+		}
+		path[sizeof(path) - 1] = '\0';
+		ret = rzs_set_backing_dev(rzs, path);
+		break;
+	}
+	case RZSIO_MARK_IDLE:
+		if (!rzs->init_done) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		rzs_mark_idle(rzs);
+		break;
+
+	case RZSIO_WRITEBACK:
+		mutex_lock(&rzs->wb_lock);
+		if (!rzs->init_done || !rzs->backing_bdev)
+			ret = -ENOTTY;
+		else
+			ret = rzs_writeback(rzs, arg);
+		mutex_unlock(&rzs->wb_lock);
+		break;
+
+	case RZSIO_COMPACT:
+		mutex_lock(&rzs->lock);
+		if (rzs->init_done)
+			rzs_compact(rzs, UINT_MAX);
+		else
+			ret = -ENOTTY;
+		mutex_unlock(&rzs->lock);
+		break;
+
 	case RZSIO_INIT:
 		ret = ramzswap_ioctl_init_device(rzs);
 		break;
@@ -687,7 +1568,9 @@ void ramzswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct ramzswap *rzs;
 
 	rzs = bdev->bd_disk->private_data;
+	read_lock(&rzs->compact_lock);
 	ramzswap_free_page(rzs, index);
+	read_unlock(&rzs->compact_lock);
 	rzs_stat64_inc(rzs, &rzs->stats.notify_free);
 
 	return;
@@ -704,7 +1587,14 @@ static int create_device(struct ramzswap *rzs, int device_id)
 	int ret = 0;
 
 	mutex_init(&rzs->lock);
+	mutex_init(&rzs->wb_lock);
+	spin_lock_init(&rzs->backing_lock);
 	spin_lock_init(&rzs->stat64_lock);
+	spin_lock_init(&rzs->stream_lock);
+	spin_lock_init(&rzs->dedup_lock);
+	rwlock_init(&rzs->compact_lock);
+	INIT_LIST_HEAD(&rzs->idle_streams);
+	init_waitqueue_head(&rzs->stream_wait);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -770,6 +1660,12 @@ static int __init ramzswap_init(void)
 		goto out;
 	}
 
+	if (!crypto_has_comp(compressor, 0, 0)) {
+		pr_warning("Invalid value for compressor: %s\n", compressor);
+		ret = -EINVAL;
+		goto out;
+	}
+
 	ramzswap_major = register_blkdev(0, "ramzswap");
 	if (ramzswap_major <= 0) {
 		pr_warning("Unable to get major number\n");
@@ -782,12 +1678,18 @@ static int __init ramzswap_init(void)
 		num_devices = 1;
 	}
 
+	dedup_cache = KMEM_CACHE(rzs_dedup, 0);
+	if (!dedup_cache) {
+		ret = -ENOMEM;
+		goto unregister;
+	}
+
 	/* Allocate the device array and initialize each one */
 	pr_info("Creating %u devices ...\n", num_devices);
 	devices = kzalloc(num_devices * sizeof(struct ramzswap), GFP_KERNEL);
 	if (!devices) {
 		ret = -ENOMEM;
-		goto unregister;
+		goto destroy_cache;
 	}
 
 	for (dev_id = 0; dev_id < num_devices; dev_id++) {
@@ -796,11 +1698,16 @@ static int __init ramzswap_init(void)
 			goto free_devices;
 	}
 
+	register_shrinker(&ramzswap_shrinker);
+
 	return 0;
 
 free_devices:
 	while (dev_id)
 		destroy_device(&devices[--dev_id]);
+	kfree(devices);
+destroy_cache:
+	kmem_cache_destroy(dedup_cache);
 unregister:
 	unregister_blkdev(ramzswap_major, "ramzswap");
 out:
@@ -812,23 +1719,36 @@ static void __exit ramzswap_exit(void)
 	int i;
 	struct ramzswap *rzs;
 
+	unregister_shrinker(&ramzswap_shrinker);
+
 	for (i = 0; i < num_devices; i++) {
 		rzs = &devices[i];
 
 		destroy_device(rzs);
 		if (rzs->init_done)
 			reset_device(rzs);
+		else
+			rzs_put_backing_dev(rzs);
 	}
 
 	unregister_blkdev(ramzswap_major, "ramzswap");
 
 	kfree(devices);
+	kmem_cache_destroy(dedup_cache);
 	pr_debug("Cleanup done!\n");
 }
 
 module_param(num_devices, uint, 0);
 MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
 
+module_param(num_streams, uint, 0);
+MODULE_PARM_DESC(num_streams,
+	"Number of compression streams per device (default: number of CPUs)");
+
+module_param(compressor, charp, 0);
+MODULE_PARM_DESC(compressor,
+	"Default crypto compression algorithm for new devices (default: lzo)");
+
 module_init(ramzswap_init);
 module_exit(ramzswap_exit);
 
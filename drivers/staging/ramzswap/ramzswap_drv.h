@@ -17,6 +17,9 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
+#include <linux/ktime.h>
 
 #include "ramzswap_ioctl.h"
 #include "xvmalloc.h"
@@ -41,6 +44,18 @@ struct zobj_header {
 
 /*-- Configurable parameters */
 
+/*
+ * The memory pool is compacted from the shrinker only when at least
+ * 1/2^compact_waste_shift of its pages could be freed.
+ */
+static const unsigned compact_waste_shift = 3;
+
+/* Table entries compaction scans between reschedule points */
+static const unsigned compact_batch = 256;
+
+/* Max. pages written to the backing device in one batch */
+#define WB_BATCH	32
+
 /* Default ramzswap disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
@@ -71,6 +86,15 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page was written to the backing device */
+	RZS_BACKED,
+
+	/* Page was not accessed since the last RZSIO_MARK_IDLE */
+	RZS_IDLE,
+
+	/* Page is being written to the backing device */
+	RZS_WB,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
@@ -78,13 +102,21 @@ enum rzs_pageflags {
 
 /*
  * Allocated for each swap slot, indexed by page no.
- * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
+	union {
+		struct page *page;
+		/*
+		 * Page no. on the backing device, for RZS_BACKED entries.
+		 * Page 0 is never used, so that these entries never look
+		 * empty.
+		 */
+		unsigned long backing;
+	};
 	u16 offset;
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
+	u32 hash;	/* dedup hash of a compressed object */
 } __attribute__((aligned(4)));
 
 struct ramzswap_stats {
@@ -103,16 +135,76 @@ struct ramzswap_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u64 num_compress;	/* successful compressions */
+	u64 compress_ns;	/* time spent in the compressor */
+	u64 num_decompress;	/* successful decompressions */
+	u64 decompress_ns;	/* time spent in the decompressor */
+	u64 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 dedup_hits;		/* writes that found an identical object */
+	u64 num_compactions;	/* compaction runs */
+	u64 compact_moved;	/* objects moved by compaction */
+	u32 pages_backed;	/* no. of pages on the backing device */
+	u64 bd_writes;		/* pages written back */
+	u64 bd_reads;		/* pages read from the backing device */
 #endif
 };
 
+/*
+ * A compression stream: everything needed to compress or decompress one
+ * page. Each device has a pool of them so that several readers and writers
+ * can run the compressor in parallel; only storing the result is
+ * serialized by ramzswap->lock.
+ */
+struct rzs_stream {
+	struct list_head list;	/* entry in ramzswap->idle_streams */
+	struct crypto_comp *tfm;	/* compressor instance */
+	void *buffer;		/* compressed data (2 pages) */
+};
+
+/*
+ * Index entry for a stored compressed object, so that pages with the
+ * same contents share one object instead of each storing a copy.
+ */
+struct rzs_dedup {
+	struct hlist_node node;	/* entry in ramzswap->dedup_table */
+	struct page *page;	/* location of the object */
+	u16 offset;
+	u16 clen;		/* compressed size */
+	u32 hash;		/* jhash of the compressed data */
+	u32 refcount;		/* no. of table entries using the object */
+};
+
 struct ramzswap {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
+	struct mutex lock;	/* protects table and stats updates */
+	/*
+	 * Compaction moves objects under the write lock. Readers and slot
+	 * free notifications, which do not take ramzswap->lock, hold it for
+	 * read while they use an object.
+	 */
+	rwlock_t compact_lock;
+	spinlock_t stream_lock;	/* protects idle_streams */
+	struct list_head idle_streams;
+	wait_queue_head_t stream_wait;	/* waiting for an idle stream */
+	unsigned int num_streams;
+	/*
+	 * Protects the dedup index. Slot free notifications come in under
+	 * swap_lock and cannot take ramzswap->lock.
+	 */
+	spinlock_t dedup_lock;
+	struct hlist_head *dedup_table;
+	u32 dedup_mask;		/* no. of dedup_table buckets - 1 */
+	/* crypto compression algorithm, empty for the module default */
+	char compressor[RZS_MAX_COMPRESSOR_NAME];
+	/* optional device incompressible and idle pages are written to */
+	struct mutex wb_lock;	/* serializes writeback with reset */
+	struct block_device *backing_bdev;
+	spinlock_t backing_lock;	/* protects backing_map and _cursor */
+	unsigned long *backing_map;	/* used pages of the backing device */
+	unsigned long backing_pages;
+	unsigned long backing_cursor;	/* keeps writes sequential */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -147,6 +239,13 @@ static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
 	spin_unlock(&rzs->stat64_lock);
 }
 
+static void rzs_stat64_dec(struct ramzswap *rzs, u64 *v)
+{
+	spin_lock(&rzs->stat64_lock);
+	*v = *v - 1;
+	spin_unlock(&rzs->stat64_lock);
+}
+
 static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 {
 	u64 val;
@@ -157,11 +256,31 @@ static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 
 	return val;
 }
+
+static ktime_t rzs_clock(void)
+{
+	return ktime_get();
+}
+
+/* Accounts one (de)compression that started at @start */
+static void rzs_stat64_time(struct ramzswap *rzs, u64 *count, u64 *ns,
+			ktime_t start)
+{
+	s64 delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&rzs->stat64_lock);
+	*count = *count + 1;
+	*ns = *ns + delta;
+	spin_unlock(&rzs->stat64_lock);
+}
 #else
 #define rzs_stat_inc(v)
 #define rzs_stat_dec(v)
 #define rzs_stat64_inc(r, v)
+#define rzs_stat64_dec(r, v)
 #define rzs_stat64_read(r, v)
+#define rzs_clock()	ktime_set(0, 0)
+#define rzs_stat64_time(r, c, n, s)	((void)(s))
 #endif /* CONFIG_RAMZSWAP_STATS */
 
 #endif
@@ -15,6 +15,19 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+/* Longest crypto compression algorithm name a device can be set to */
+#define RZS_MAX_COMPRESSOR_NAME	32
+
+/* Longest path of a backing device */
+#define RZS_MAX_BACKING_NAME	64
+
+/* RZSIO_WRITEBACK argument: which pages to move to the backing device */
+#define RZS_WB_HUGE		0x1	/* incompressible pages */
+#define RZS_WB_IDLE		0x2	/* not accessed since RZSIO_MARK_IDLE */
+
+/* Memory pool pages are grouped by how full they are, in 1/4 page steps */
+#define RZS_NR_FILL_CLASSES	4
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -32,11 +45,36 @@ struct ramzswap_ioctl_stats {
 	u64 orig_data_size;
 	u64 compr_data_size;
 	u64 mem_used_total;
+	/*
+	 * Per backend stats. Older tools pass a smaller structure, which
+	 * only gets the fields above.
+	 */
+	char compressor[RZS_MAX_COMPRESSOR_NAME];
+	u32 compr_ratio_pct;	/* compr_data_size / orig_data_size */
+	u64 num_compress;	/* successful compressions */
+	u64 compress_ns;	/* total time spent compressing */
+	u64 num_decompress;	/* successful decompressions */
+	u64 decompress_ns;	/* total time spent decompressing */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 num_dedup_hits;	/* writes that found an identical object */
+	u64 pool_used_bytes;	/* allocated in the memory pool */
+	u32 pool_pages_by_fill[RZS_NR_FILL_CLASSES];
+	u64 num_compactions;	/* compaction runs */
+	u64 compact_moved;	/* objects moved by compaction */
+	u64 compact_freed_pages; /* pool pages freed by compaction */
+	u32 pages_backed;	/* no. of pages on the backing device */
+	u64 bd_writes;		/* pages written back */
+	u64 bd_reads;		/* pages read from the backing device */
 } __attribute__ ((packed, aligned(4)));
 
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_COMPRESSOR	_IOW('z', 4, char[RZS_MAX_COMPRESSOR_NAME])
+#define RZSIO_COMPACT		_IO('z', 5)
+#define RZSIO_SET_BACKING_DEV	_IOW('z', 6, char[RZS_MAX_BACKING_NAME])
+#define RZSIO_MARK_IDLE		_IO('z', 7)
+#define RZSIO_WRITEBACK		_IO('z', 8)	/* arg: RZS_WB_* flags */
 
 #endif
@@ -14,6 +14,7 @@
 #include <linux/errno.h>
 #include <linux/highmem.h>
 #include <linux/init.h>
+#include <linux/mm.h>
 #include <linux/string.h>
 #include <linux/slab.h>
 
@@ -79,6 +80,32 @@ static struct block_header *BLOCK_NEXT(struct block_header *block)
 		((char *)block + block->size + XV_ALIGN);
 }
 
+static u32 page_used(struct page *page)
+{
+	return page_private(page) & XV_PAGE_USED_MASK;
+}
+
+static u32 fill_class(u32 used)
+{
+	return min_t(u32, used * XV_NR_FILL_CLASSES / PAGE_SIZE,
+			XV_NR_FILL_CLASSES - 1);
+}
+
+/*
+ * Account @delta bytes allocated (or freed, if negative) in @page.
+ */
+static void page_account(struct xv_pool *pool, struct page *page, int delta)
+{
+	u32 used = page_used(page);
+
+	pool->fill_pages[fill_class(used)]--;
+	used += delta;
+	pool->fill_pages[fill_class(used)]++;
+	pool->used_bytes += delta;
+
+	set_page_private(page, (page_private(page) & XV_PAGE_ISOLATED) | used);
+}
+
 /*
  * Get index of free list containing blocks of maximum size
  * which is less than or equal to given size.
@@ -284,9 +311,13 @@ static int grow_pool(struct xv_pool *pool, gfp_t flags)
 	if (unlikely(!page))
 		return -ENOMEM;
 
-	stat_inc(&pool->total_pages);
+	set_page_private(page, 0);
 
 	spin_lock(&pool->lock);
+	stat_inc(&pool->total_pages);
+	pool->fill_pages[0]++;
+	list_add(&page->lru, &pool->pages);
+
 	block = get_ptr_atomic(page, 0, KM_USER0);
 
 	block->size = PAGE_SIZE - XV_ALIGN;
@@ -317,6 +348,8 @@ struct xv_pool *xv_create_pool(void)
 		return NULL;
 
 	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->pages);
+	INIT_LIST_HEAD(&pool->isolated);
 
 	return pool;
 }
@@ -361,7 +394,7 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 
 	if (!*page) {
 		spin_unlock(&pool->lock);
-		if (flags & GFP_NOWAIT)
+		if (!(flags & __GFP_WAIT))
 			return -ENOMEM;
 		error = grow_pool(pool, flags);
 		if (unlikely(error))
@@ -407,6 +440,7 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
 	clear_flag(block, BLOCK_FREE);
 
 	put_ptr_atomic(block, KM_USER0);
+	page_account(pool, *page, size + XV_ALIGN);
 	spin_unlock(&pool->lock);
 
 	*offset += XV_ALIGN;
@@ -419,6 +453,7 @@ int xv_malloc(struct xv_pool *pool, u32 size, struct page **page,
  */
 void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 {
+	int isolated;
 	void *page_start;
 	struct block_header *block, *tmpblock;
 
@@ -426,6 +461,9 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 
 	spin_lock(&pool->lock);
 
+	/* Free blocks of isolated pages are kept off the free lists */
+	isolated = xv_page_isolated(page);
+
 	page_start = get_ptr_atomic(page, 0, KM_USER0);
 	block = (struct block_header *)((char *)page_start + offset);
 
@@ -433,6 +471,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	BUG_ON(test_flag(block, BLOCK_FREE));
 
 	block->size = ALIGN(block->size, XV_ALIGN);
+	page_account(pool, page, -(block->size + XV_ALIGN));
 
 	tmpblock = BLOCK_NEXT(block);
 	if (offset + block->size + XV_ALIGN == PAGE_SIZE)
@@ -444,7 +483,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 		 * Blocks smaller than XV_MIN_ALLOC_SIZE
 		 * are not inserted in any free list.
 		 */
-		if (tmpblock->size >= XV_MIN_ALLOC_SIZE) {
+		if (!isolated && tmpblock->size >= XV_MIN_ALLOC_SIZE) {
 			remove_block(pool, page,
 				    offset + block->size + XV_ALIGN, tmpblock,
 				    get_index_for_insert(tmpblock->size));
@@ -458,7 +497,7 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 						get_blockprev(block));
 		offset = offset - tmpblock->size - XV_ALIGN;
 
-		if (tmpblock->size >= XV_MIN_ALLOC_SIZE)
+		if (!isolated && tmpblock->size >= XV_MIN_ALLOC_SIZE)
 			remove_block(pool, page, offset, tmpblock,
 				    get_index_for_insert(tmpblock->size));
 
@@ -469,15 +508,23 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset)
 	/* No used objects in this page. Free it. */
 	if (block->size == PAGE_SIZE - XV_ALIGN) {
 		put_ptr_atomic(page_start, KM_USER0);
+
+		list_del(&page->lru);
+		pool->fill_pages[0]--;
+		stat_dec(&pool->total_pages);
+		if (isolated) {
+			pool->nr_isolated--;
+			stat_inc(&pool->compacted_pages);
+		}
 		spin_unlock(&pool->lock);
 
+		set_page_private(page, 0);
 		__free_page(page);
-		stat_dec(&pool->total_pages);
 		return;
 	}
 
 	set_flag(block, BLOCK_FREE);
-	if (block->size >= XV_MIN_ALLOC_SIZE)
+	if (!isolated && block->size >= XV_MIN_ALLOC_SIZE)
 		insert_block(pool, page, offset, block);
 
 	if (offset + block->size + XV_ALIGN != PAGE_SIZE) {
@@ -505,3 +552,134 @@ u64 xv_get_total_size_bytes(struct xv_pool *pool)
 {
 	return pool->total_pages << PAGE_SHIFT;
 }
+
+void xv_get_pool_stats(struct xv_pool *pool, struct xv_pool_stats *stats)
+{
+	spin_lock(&pool->lock);
+	stats->total_pages = pool->total_pages;
+	stats->used_bytes = pool->used_bytes;
+	stats->compacted_pages = pool->compacted_pages;
+	memcpy(stats->pages_by_fill, pool->fill_pages,
+		sizeof(stats->pages_by_fill));
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Add (or remove) all free blocks of a page to (from) the free lists.
+ */
+static void page_freelist_op(struct xv_pool *pool, struct page *page,
+			int insert)
+{
+	u32 offset = 0;
+	void *page_start;
+	struct block_header *block;
+
+	page_start = get_ptr_atomic(page, 0, KM_USER0);
+
+	while (offset < PAGE_SIZE) {
+		block = (struct block_header *)((char *)page_start + offset);
+
+		if (test_flag(block, BLOCK_FREE) &&
+		    block->size >= XV_MIN_ALLOC_SIZE) {
+			if (insert)
+				insert_block(pool, page, offset, block);
+			else
+				remove_block(pool, page, offset, block,
+					get_index_for_insert(block->size));
+		}
+
+		/* Allocated blocks keep their unaligned size */
+		offset += ALIGN(block->size, XV_ALIGN) + XV_ALIGN;
+	}
+
+	put_ptr_atomic(page_start, KM_USER0);
+}
+
+/**
+ * xv_isolate_sparse_pages - set aside pages for compaction
+ * @pool: pool to compact
+ * @max_pages: maximum number of pages to isolate
+ *
+ * Picks at most @max_pages pages that are less than half full, emptiest
+ * first, and takes their free blocks off the free lists so that new
+ * objects are not allocated from them. Only as many pages are taken as
+ * the free space in the remaining pages can absorb. The caller then
+ * moves the objects out of isolated pages (see xv_page_isolated()), and
+ * each page is freed as soon as its last object is. Pages that could not
+ * be emptied must be returned with xv_putback_pages().
+ *
+ * Returns the number of pages isolated.
+ */
+u32 xv_isolate_sparse_pages(struct xv_pool *pool, u32 max_pages)
+{
+	u32 class, used, nr = 0;
+	u64 moving = 0, room;
+	struct page *page, *tmp;
+
+	spin_lock(&pool->lock);
+
+	for (class = 0; class < XV_NR_FILL_CLASSES / 2; class++) {
+		list_for_each_entry_safe(page, tmp, &pool->pages, lru) {
+			if (nr == max_pages)
+				goto out;
+
+			used = page_used(page);
+			if (fill_class(used) != class)
+				continue;
+
+			/* Free space left in the pages we are not isolating */
+			room = (pool->total_pages - pool->nr_isolated - 1)
+					* PAGE_SIZE
+				- (pool->used_bytes - moving - used);
+			if (moving + used > room)
+				goto out;
+
+			page_freelist_op(pool, page, 0);
+			set_page_private(page,
+				page_private(page) | XV_PAGE_ISOLATED);
+			list_move(&page->lru, &pool->isolated);
+			pool->nr_isolated++;
+
+			moving += used;
+			nr++;
+		}
+	}
+
+out:
+	spin_unlock(&pool->lock);
+	return nr;
+}
+
+/*
+ * Returns the pages still isolated to the free lists. Returns how many
+ * there were.
+ */
+u32 xv_putback_pages(struct xv_pool *pool)
+{
+	u32 nr = 0;
+	struct page *page, *tmp;
+
+	spin_lock(&pool->lock);
+
+	list_for_each_entry_safe(page, tmp, &pool->isolated, lru) {
+		set_page_private(page,
+			page_private(page) & ~XV_PAGE_ISOLATED);
+		page_freelist_op(pool, page, 1);
+		list_move(&page->lru, &pool->pages);
+		nr++;
+	}
+	pool->nr_isolated = 0;
+
+	spin_unlock(&pool->lock);
+	return nr;
+}
+
+u32 xv_get_isolated_pages(struct xv_pool *pool)
+{
+	return pool->nr_isolated;
+}
+
+int xv_page_isolated(struct page *page)
+{
+	return !!(page_private(page) & XV_PAGE_ISOLATED);
+}
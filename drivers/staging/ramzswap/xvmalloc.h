@@ -16,6 +16,17 @@
 #include <linux/types.h>
 
 struct xv_pool;
+struct page;
+
+/* Pool pages are grouped by how full they are, in steps of 1/4 page */
+#define XV_NR_FILL_CLASSES	4
+
+struct xv_pool_stats {
+	u64 total_pages;
+	u64 used_bytes;		/* allocated objects, including headers */
+	u64 compacted_pages;	/* pages freed by compaction */
+	u32 pages_by_fill[XV_NR_FILL_CLASSES];
+};
 
 struct xv_pool *xv_create_pool(void);
 void xv_destroy_pool(struct xv_pool *pool);
@@ -26,5 +37,11 @@ void xv_free(struct xv_pool *pool, struct page *page, u32 offset);
 
 u32 xv_get_object_size(void *obj);
 u64 xv_get_total_size_bytes(struct xv_pool *pool);
+void xv_get_pool_stats(struct xv_pool *pool, struct xv_pool_stats *stats);
+
+u32 xv_isolate_sparse_pages(struct xv_pool *pool, u32 max_pages);
+u32 xv_putback_pages(struct xv_pool *pool);
+u32 xv_get_isolated_pages(struct xv_pool *pool);
+int xv_page_isolated(struct page *page);
 
 #endif
@@ -14,8 +14,11 @@
 #define _XV_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/list.h>
 #include <linux/types.h>
 
+#include "xvmalloc.h"
+
 /* User configurable params */
 
 /* Must be power of two */
@@ -47,6 +50,13 @@ enum blockflags {
 #define FLAGS_MASK	XV_ALIGN_MASK
 #define PREV_MASK	(~FLAGS_MASK)
 
+/*
+ * page->private of a pool page holds the bytes used by allocated blocks
+ * (headers included), plus a flag for pages set aside for compaction.
+ */
+#define XV_PAGE_ISOLATED	(1UL << 31)
+#define XV_PAGE_USED_MASK	(XV_PAGE_ISOLATED - 1)
+
 struct freelist_entry {
 	struct page *page;
 	u16 offset;
@@ -79,8 +89,16 @@ struct xv_pool {
 
 	struct freelist_entry freelist[NUM_FREE_LISTS];
 
+	/* pages are linked through page->lru */
+	struct list_head pages;
+	struct list_head isolated;	/* being emptied by compaction */
+	u32 nr_isolated;
+
 	/* stats */
 	u64 total_pages;
+	u64 used_bytes;
+	u64 compacted_pages;
+	u32 fill_pages[XV_NR_FILL_CLASSES];
 };
 
 #endif
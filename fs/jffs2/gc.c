@@ -533,7 +533,7 @@ static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_era
 		ret = jffs2_garbage_collect_dirent(c, jeb, f, fd);
 	} else if (fd) {
 		ret = jffs2_garbage_collect_deletion_dirent(c, jeb, f, fd);
-	} else {
+	} else if (!jffs2_index_gc(c, f, raw)) {
 		printk(KERN_WARNING "Raw node at 0x%08x wasn't in node lists for ino #%u\n",
 		       ref_offset(raw), f->inocache->ino);
 		if (ref_obsolete(raw)) {
@@ -0,0 +1,653 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * Inode index nodes.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ */
+
+/*
+ * Reading a large file means reading the header of every one of its nodes
+ * and sorting them into a fragment tree by version. An inode index node is
+ * a snapshot of the result: the fragment map of a regular file, and its
+ * attributes, as of the highest node version of the inode. read_inode()
+ * builds the fragment tree straight from it when it still matches the
+ * nodes of the inode, and falls back to reading them all otherwise.
+ *
+ * The index is trusted only if no node of the inode was written after it.
+ * The scan tracks that with the node versions, and at run time any node
+ * written for the inode marks its index stale. Every node the index refers
+ * to must still be a valid node of the inode; nodes of the inode which it
+ * doesn't refer to are older ones which were obsolete when it was written,
+ * and are obsoleted again, just as read_inode() would.
+ *
+ * Flash offsets are reused once their eraseblock is erased, so the index
+ * records the version of each node along with its offset, and read_inode()
+ * checks the header of every node it refers to before trusting it.
+ *
+ * The node type is RWCOMPAT_DELETE, so older kernels simply treat index
+ * nodes as dirty space. Index nodes are never moved by GC either: GC
+ * obsoletes them and a new one is written at the next sync.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/sort.h>
+#include <linux/crc32.h>
+#include <linux/mtd/mtd.h>
+#include "nodelist.h"
+
+void jffs2_index_scan_dnode(struct jffs2_inode_cache *ic, uint32_t version)
+{
+	if (version > ic->index_version) {
+		ic->index_version = version;
+		ic->index_ofs = 0;
+	}
+}
+
+void jffs2_index_scan_index(struct jffs2_inode_cache *ic, uint32_t ofs, uint32_t version)
+{
+	if (version >= ic->index_version) {
+		ic->index_version = version;
+		ic->index_ofs = ofs | JFFS2_INDEX_PRESENT;
+	}
+}
+
+/* A node was written for the inode. Called with the alloc_sem held. */
+void jffs2_index_stale(struct jffs2_inode_cache *ic)
+{
+	if (ic && ic->class == RAWNODE_CLASS_INODE_CACHE &&
+	    (ic->index_ofs & JFFS2_INDEX_PRESENT))
+		ic->index_ofs |= JFFS2_INDEX_STALE;
+}
+
+/* Obsolete the index node of the inode, if it has one */
+void jffs2_index_drop(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic)
+{
+	struct jffs2_raw_node_ref *ref;
+	uint32_t ofs = ic->index_ofs & ~3;
+
+	if (!(ic->index_ofs & JFFS2_INDEX_PRESENT))
+		return;
+	ic->index_ofs = 0;
+
+	spin_lock(&c->erase_completion_lock);
+	for (ref = ic->nodes; ref && ref->next_in_ino; ref = ref->next_in_ino) {
+		if (!ref_obsolete(ref) && ref_offset(ref) == ofs)
+			break;
+	}
+	spin_unlock(&c->erase_completion_lock);
+
+	/* Valid nodes don't go away without the lock */
+	if (ref && ref->next_in_ino)
+		jffs2_mark_node_obsolete(c, ref);
+}
+
+/* GC found a node of the inode which isn't in any of its in-core lists.
+   If it's an index node, obsolete it and queue the inode for a new one. */
+int jffs2_index_gc(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+		   struct jffs2_raw_node_ref *raw)
+{
+	struct jffs2_inode_cache *ic = f->inocache;
+	struct jffs2_unknown_node node;
+	size_t retlen;
+	int ret;
+
+	if ((ic->index_ofs & 3) && (ic->index_ofs & ~3) == ref_offset(raw)) {
+		ic->index_ofs = 0;
+	} else {
+		/* Not the one we know of; one moved by wbuf recovery? */
+		ret = jffs2_flash_read(c, ref_offset(raw), sizeof(node), &retlen, (void *)&node);
+		if (ret || retlen != sizeof(node) ||
+		    je16_to_cpu(node.nodetype) != JFFS2_NODETYPE_INODE_INDEX)
+			return 0;
+	}
+
+	D1(printk(KERN_DEBUG "Obsoleting index node at 0x%08x of ino #%u\n",
+		  ref_offset(raw), ic->ino));
+	jffs2_mark_node_obsolete(c, raw);
+	jffs2_index_queue(c, f);
+	return 1;
+}
+
+static int index_ref_cmp(const void *a, const void *b)
+{
+	uint32_t x = ref_offset(*(struct jffs2_raw_node_ref **)a);
+	uint32_t y = ref_offset(*(struct jffs2_raw_node_ref **)b);
+
+	return x < y ? -1 : x > y;
+}
+
+static int index_find_ref(struct jffs2_raw_node_ref **refs, int nr, uint32_t ofs)
+{
+	int lo = 0, hi = nr - 1, mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (ref_offset(refs[mid]) == ofs)
+			return mid;
+		if (ref_offset(refs[mid]) < ofs)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+/* The valid nodes of the inode, sorted by flash offset. Nobody can add
+   nodes to the inode while we hold f->sem and it's being read. */
+static struct jffs2_raw_node_ref **index_valid_refs(struct jffs2_sb_info *c,
+						    struct jffs2_inode_cache *ic,
+						    int *nr)
+{
+	struct jffs2_raw_node_ref *ref, **refs;
+	int n = 0, i = 0;
+
+	spin_lock(&c->erase_completion_lock);
+	for (ref = ic->nodes; ref && ref->next_in_ino; ref = ref->next_in_ino) {
+		if (!ref_obsolete(ref))
+			n++;
+	}
+	spin_unlock(&c->erase_completion_lock);
+
+	if (!n)
+		return NULL;
+	refs = kmalloc(n * sizeof(*refs), GFP_KERNEL);
+	if (!refs)
+		return NULL;
+
+	spin_lock(&c->erase_completion_lock);
+	for (ref = ic->nodes; ref && ref->next_in_ino; ref = ref->next_in_ino) {
+		if (ref_obsolete(ref))
+			continue;
+		if (i < n)
+			refs[i] = ref;
+		i++;
+	}
+	spin_unlock(&c->erase_completion_lock);
+
+	if (i != n) {
+		kfree(refs);
+		return NULL;
+	}
+
+	sort(refs, n, sizeof(*refs), index_ref_cmp, NULL);
+	*nr = n;
+	return refs;
+}
+
+static struct jffs2_raw_inode_index *index_read_node(struct jffs2_sb_info *c,
+						     struct jffs2_inode_cache *ic,
+						     uint32_t ofs)
+{
+	struct jffs2_raw_inode_index hdr, *ri;
+	uint32_t nr, len, crc;
+	size_t retlen;
+	int ret;
+
+	ret = jffs2_flash_read(c, ofs, sizeof(hdr), &retlen, (void *)&hdr);
+	if (ret || retlen != sizeof(hdr))
+		return NULL;
+
+	crc = crc32(0, &hdr, sizeof(hdr) - 8);
+	nr = je32_to_cpu(hdr.nr_frags);
+	len = sizeof(hdr) + nr * sizeof(struct jffs2_index_frag);
+	if (je16_to_cpu(hdr.magic) != JFFS2_MAGIC_BITMASK ||
+	    je16_to_cpu(hdr.nodetype) != JFFS2_NODETYPE_INODE_INDEX ||
+	    crc != je32_to_cpu(hdr.node_crc) ||
+	    je32_to_cpu(hdr.ino) != ic->ino ||
+	    nr > JFFS2_INDEX_MAX_FRAGS || je32_to_cpu(hdr.totlen) != len ||
+	    !S_ISREG(jemode_to_cpu(hdr.mode))) {
+		JFFS2_NOTICE("bad index node at %#08x for ino #%u\n", ofs, ic->ino);
+		return NULL;
+	}
+
+	ri = kmalloc(len, GFP_KERNEL);
+	if (!ri)
+		return NULL;
+	memcpy(ri, &hdr, sizeof(hdr));
+
+	ret = jffs2_flash_read(c, ofs + sizeof(hdr), len - sizeof(hdr), &retlen,
+			       (void *)ri->frags);
+	if (ret || retlen != len - sizeof(hdr))
+		goto bad;
+
+	crc = crc32(0, ri->frags, len - sizeof(hdr));
+	if (crc != je32_to_cpu(ri->data_crc)) {
+		JFFS2_NOTICE("index node at %#08x: data CRC failed, read %#08x, calculated %#08x\n",
+			     ofs, je32_to_cpu(ri->data_crc), crc);
+		goto bad;
+	}
+	return ri;
+
+ bad:
+	kfree(ri);
+	return NULL;
+}
+
+/*
+ * Read the header of the data node at 'ref' and check that it's a valid node
+ * of inode 'ino'. Returns its version and the range of the file it covers,
+ * the way read_dnode() works them out.
+ */
+static int index_read_dnode(struct jffs2_sb_info *c, uint32_t ino,
+			    struct jffs2_raw_node_ref *ref, uint32_t *version,
+			    uint32_t *ofs, uint32_t *size)
+{
+	struct jffs2_raw_inode rn;
+	size_t retlen;
+	uint32_t crc;
+	int ret;
+
+	ret = jffs2_flash_read(c, ref_offset(ref), sizeof(rn), &retlen, (void *)&rn);
+	if (ret || retlen != sizeof(rn))
+		return -EIO;
+
+	crc = crc32(0, &rn, sizeof(rn) - 8);
+	if (je16_to_cpu(rn.magic) != JFFS2_MAGIC_BITMASK ||
+	    je16_to_cpu(rn.nodetype) != JFFS2_NODETYPE_INODE ||
+	    crc != je32_to_cpu(rn.node_crc) || je32_to_cpu(rn.ino) != ino)
+		return -EINVAL;
+
+	*version = je32_to_cpu(rn.version);
+	*ofs = je32_to_cpu(rn.offset);
+	/* Hole nodes with csize/dsize swapped, see read_dnode() */
+	if (rn.compr == JFFS2_COMPR_ZERO && !je32_to_cpu(rn.dsize) && je32_to_cpu(rn.csize))
+		*size = je32_to_cpu(rn.csize);
+	else
+		*size = je32_to_cpu(rn.dsize);
+	return 0;
+}
+
+/* Like check_node_data(), for a node the index vouches for */
+static void index_mark_checked(struct jffs2_sb_info *c, struct jffs2_raw_node_ref *ref)
+{
+	struct jffs2_eraseblock *jeb = &c->blocks[ref->flash_offset / c->sector_size];
+	uint32_t len = ref_totlen(c, jeb, ref);
+
+	spin_lock(&c->erase_completion_lock);
+	mark_ref_normal(ref);
+	jeb->used_size += len;
+	jeb->unchecked_size -= len;
+	c->used_size += len;
+	c->unchecked_size -= len;
+	jffs2_dbg_acct_paranoia_check_nolock(c, jeb);
+	spin_unlock(&c->erase_completion_lock);
+}
+
+/*
+ * Build the fragment tree of the inode from its index node.
+ * Called with f->sem held. Returns 0 if it did, and 1 if the caller
+ * has to read all the nodes of the inode instead.
+ */
+int jffs2_read_inode_index(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			   struct jffs2_raw_inode *latest_node)
+{
+	struct jffs2_inode_cache *ic = f->inocache;
+	struct jffs2_raw_node_ref **refs;
+	struct jffs2_raw_inode_index *ri = NULL;
+	struct jffs2_full_dnode **fns = NULL, *fn, *metadata = NULL;
+	struct jffs2_index_frag *e;
+	struct jffs2_node_frag *frag;
+	struct rb_node *parent = NULL, **link = &f->fragtree.rb_node;
+	uint32_t end = 0, ofs, size, node, version;
+	uint32_t node_version, node_ofs, node_size;
+	int nr_refs, self, i, n, ret = 1;
+
+	if ((ic->index_ofs & 3) != JFFS2_INDEX_PRESENT)
+		return 1;
+
+	refs = index_valid_refs(c, ic, &nr_refs);
+	if (!refs)
+		return 1;
+
+	self = index_find_ref(refs, nr_refs, ic->index_ofs & ~3);
+	if (self < 0)
+		goto out;
+	ri = index_read_node(c, ic, ic->index_ofs & ~3);
+	if (!ri)
+		goto out;
+	fns = kcalloc(nr_refs, sizeof(*fns), GFP_KERNEL);
+	if (!fns)
+		goto out;
+
+	for (i = 0; i < je32_to_cpu(ri->nr_frags); i++) {
+		e = &ri->frags[i];
+		ofs = je32_to_cpu(e->ofs);
+		size = je32_to_cpu(e->size);
+		if (ofs != end || !size || ofs + size < ofs)
+			goto bad;
+		end = ofs + size;
+
+		fn = NULL;
+		node = je32_to_cpu(e->node);
+		if (node != JFFS2_INDEX_HOLE) {
+			n = index_find_ref(refs, nr_refs, node);
+			if (n < 0 || n == self)
+				goto bad;
+			fn = fns[n];
+			if (!fn) {
+				/* The node at that offset has to be the one
+				   the index was written for */
+				version = je32_to_cpu(e->version);
+				if (version > je32_to_cpu(ri->version) ||
+				    index_read_dnode(c, ic->ino, refs[n], &node_version,
+						     &node_ofs, &node_size) ||
+				    node_version != version ||
+				    node_ofs != je32_to_cpu(e->node_ofs) ||
+				    node_size != je32_to_cpu(e->node_size) || !node_size)
+					goto bad;
+				fn = fns[n] = jffs2_alloc_full_dnode();
+				if (!fn)
+					goto bad;
+				fn->raw = refs[n];
+				fn->ofs = node_ofs;
+				fn->size = node_size;
+				fn->frags = 0;
+			}
+			if (fn->ofs != je32_to_cpu(e->node_ofs) ||
+			    fn->size != je32_to_cpu(e->node_size) ||
+			    ofs < fn->ofs || end - fn->ofs > fn->size)
+				goto bad;
+		}
+
+		frag = jffs2_alloc_node_frag();
+		if (!frag)
+			goto bad;
+		frag->ofs = ofs;
+		frag->size = size;
+		frag->node = fn;
+		if (fn)
+			fn->frags++;
+
+		/* Always the rightmost node so far */
+		rb_link_node(&frag->rb, parent, link);
+		rb_insert_color(&frag->rb, &f->fragtree);
+		parent = &frag->rb;
+		link = &frag->rb.rb_right;
+	}
+
+	if (end != je32_to_cpu(ri->isize))
+		goto bad;
+
+	node = je32_to_cpu(ri->metadata);
+	if (node != JFFS2_INDEX_HOLE) {
+		n = index_find_ref(refs, nr_refs, node);
+		if (n < 0 || n == self || fns[n])
+			goto bad;
+		version = je32_to_cpu(ri->metadata_version);
+		if (version > je32_to_cpu(ri->version) ||
+		    index_read_dnode(c, ic->ino, refs[n], &node_version,
+				     &node_ofs, &node_size) ||
+		    node_version != version || node_size)
+			goto bad;
+		metadata = fns[n] = jffs2_alloc_full_dnode();
+		if (!metadata)
+			goto bad;
+		metadata->raw = refs[n];
+		metadata->ofs = node_ofs;
+		metadata->size = 0;
+		metadata->frags = 0;
+	}
+
+	/* It's good. Account the nodes it uses as checked, and get rid of
+	   any others, which were obsolete when the index was written */
+	for (i = 0; i < nr_refs; i++) {
+		if (i == self)
+			continue;
+		if (!fns[i])
+			jffs2_mark_node_obsolete(c, refs[i]);
+		else if (ref_flags(refs[i]) == REF_UNCHECKED)
+			index_mark_checked(c, refs[i]);
+	}
+
+	f->metadata = metadata;
+	f->highest_version = je32_to_cpu(ri->version);
+
+	memset(latest_node, 0, sizeof(*latest_node));
+	latest_node->ino = ri->ino;
+	latest_node->version = ri->version;
+	latest_node->mode = ri->mode;
+	latest_node->uid = ri->uid;
+	latest_node->gid = ri->gid;
+	latest_node->isize = ri->isize;
+	latest_node->atime = ri->atime;
+	latest_node->mtime = ri->mtime;
+	latest_node->ctime = ri->ctime;
+
+	dbg_readinode("ino #%u read from the index node at %#08x, %u frags\n",
+		      ic->ino, ic->index_ofs & ~3, je32_to_cpu(ri->nr_frags));
+	jffs2_dbg_fragtree_paranoia_check_nolock(f);
+	ret = 0;
+	goto out;
+
+ bad:
+	JFFS2_NOTICE("index node at %#08x doesn't match ino #%u, reading all nodes\n",
+		     ic->index_ofs & ~3, ic->ino);
+	/* The full read will obsolete the index node */
+	ic->index_ofs |= JFFS2_INDEX_STALE;
+	for (i = 0; i < nr_refs; i++) {
+		if (fns[i] && !fns[i]->frags)
+			jffs2_free_full_dnode(fns[i]);
+	}
+	jffs2_kill_fragtree(&f->fragtree, NULL);
+	f->fragtree = RB_ROOT;
+ out:
+	kfree(fns);
+	kfree(ri);
+	kfree(refs);
+	return ret;
+}
+
+/* Most fragments an index node can describe. Like any node it must fit
+   into one eraseblock, next to the cleanmarker and the summary. */
+static uint32_t index_max_frags(struct jffs2_sb_info *c)
+{
+	uint32_t room = c->sector_size - c->cleanmarker_size;
+	uint32_t nr;
+
+	if (jffs2_sum_active())
+		room -= PAD(JFFS2_SUMMARY_INODE_SIZE + JFFS2_SUMMARY_FRAME_SIZE);
+	if (room < sizeof(struct jffs2_raw_inode_index))
+		return 0;
+
+	nr = (room - sizeof(struct jffs2_raw_inode_index)) /
+		sizeof(struct jffs2_index_frag);
+	return min_t(uint32_t, nr, JFFS2_INDEX_MAX_FRAGS);
+}
+
+/* Number of fragments to write an index node for, or 0 if the inode
+   doesn't need one. Called with f->sem held. */
+static uint32_t index_count_frags(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	struct jffs2_inode_cache *ic = f->inocache;
+	struct jffs2_node_frag *frag;
+	uint32_t nr = 0, max = index_max_frags(c);
+
+	if (!ic || !ic->pino_nlink ||
+	    (ic->index_ofs & 3) == JFFS2_INDEX_PRESENT)
+		return 0;
+	/* read_inode() only queues regular files, and the VFS inode
+	   isn't filled in yet while it's at it */
+	if (ic->state == INO_STATE_PRESENT) {
+		if (!S_ISREG(JFFS2_F_I_MODE(f)))
+			return 0;
+	} else if (ic->state != INO_STATE_READING) {
+		return 0;
+	}
+	if (f->metadata && ref_flags(f->metadata->raw) == REF_UNCHECKED)
+		return 0;
+
+	for (frag = frag_first(&f->fragtree); frag; frag = frag_next(frag)) {
+		if (frag->node && ref_flags(frag->node->raw) == REF_UNCHECKED)
+			return 0;
+		if (++nr > max)
+			return 0;
+	}
+	return nr < JFFS2_INDEX_MIN_FRAGS ? 0 : nr;
+}
+
+/* Queue a regular file for an index node. Called with f->sem held. */
+void jffs2_index_queue(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	uint32_t ino = f->inocache->ino;
+	int i;
+
+	if (jffs2_is_readonly(c) || !index_count_frags(c, f))
+		return;
+
+	spin_lock(&c->inocache_lock);
+	for (i = 0; i < c->index_npending; i++) {
+		if (c->index_pending[i] == ino)
+			break;
+	}
+	if (i == c->index_npending && i < JFFS2_INDEX_PENDING)
+		c->index_pending[c->index_npending++] = ino;
+	spin_unlock(&c->inocache_lock);
+}
+
+static void jffs2_write_inode_index(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	struct jffs2_raw_inode_index *ri;
+	struct jffs2_index_frag *e;
+	struct jffs2_node_frag *frag, *last;
+	struct jffs2_raw_node_ref *ref, *prev = NULL;
+	struct kvec vec;
+	uint32_t nr, len, alloclen, flash_ofs;
+	uint32_t version = 0, node_ofs, node_size;
+	size_t retlen;
+	int ret;
+
+	mutex_lock(&f->sem);
+	nr = index_count_frags(c, f);
+	mutex_unlock(&f->sem);
+	if (!nr)
+		return;
+
+	len = sizeof(*ri) + nr * sizeof(*e);
+	ri = kmalloc(len, GFP_KERNEL);
+	if (!ri)
+		return;
+
+	ret = jffs2_reserve_space(c, len, &alloclen, ALLOC_NORMAL,
+				  JFFS2_SUMMARY_INODE_SIZE);
+	if (ret)
+		goto out_free;
+	/* The node can't be split, so it has to fit as a whole */
+	if (alloclen < len)
+		goto out_complete;
+
+	mutex_lock(&f->sem);
+	/* It may have changed while we were waiting for space */
+	if (index_count_frags(c, f) != nr)
+		goto out_unlock;
+
+	/* The attributes come from the in-core inode, just as they do
+	   when GC writes a new metadata node */
+	last = frag_last(&f->fragtree);
+	memset(ri, 0, sizeof(*ri));
+	ri->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	ri->nodetype = cpu_to_je16(JFFS2_NODETYPE_INODE_INDEX);
+	ri->totlen = cpu_to_je32(len);
+	ri->hdr_crc = cpu_to_je32(crc32(0, ri, sizeof(struct jffs2_unknown_node)-4));
+	ri->ino = cpu_to_je32(f->inocache->ino);
+	ri->version = cpu_to_je32(f->highest_version);
+	ri->mode = cpu_to_jemode(JFFS2_F_I_MODE(f));
+	ri->uid = cpu_to_je16(JFFS2_F_I_UID(f));
+	ri->gid = cpu_to_je16(JFFS2_F_I_GID(f));
+	ri->isize = cpu_to_je32(last->ofs + last->size);
+	ri->atime = cpu_to_je32(JFFS2_F_I_ATIME(f));
+	ri->mtime = cpu_to_je32(JFFS2_F_I_MTIME(f));
+	ri->ctime = cpu_to_je32(JFFS2_F_I_CTIME(f));
+	ri->metadata = cpu_to_je32(JFFS2_INDEX_HOLE);
+	if (f->metadata) {
+		/* The in-core nodes don't keep their version */
+		if (index_read_dnode(c, f->inocache->ino, f->metadata->raw,
+				     &version, &node_ofs, &node_size))
+			goto out_unlock;
+		ri->metadata = cpu_to_je32(ref_offset(f->metadata->raw));
+		ri->metadata_version = cpu_to_je32(version);
+	}
+	ri->nr_frags = cpu_to_je32(nr);
+
+	e = ri->frags;
+	for (frag = frag_first(&f->fragtree); frag; frag = frag_next(frag), e++) {
+		e->ofs = cpu_to_je32(frag->ofs);
+		e->size = cpu_to_je32(frag->size);
+		if (frag->node) {
+			ref = frag->node->raw;
+			if (ref != prev &&
+			    (index_read_dnode(c, f->inocache->ino, ref, &version,
+					      &node_ofs, &node_size) ||
+			     node_ofs != frag->node->ofs ||
+			     node_size != frag->node->size))
+				goto out_unlock;
+			prev = ref;
+			e->node = cpu_to_je32(ref_offset(ref));
+			e->version = cpu_to_je32(version);
+			e->node_ofs = cpu_to_je32(frag->node->ofs);
+			e->node_size = cpu_to_je32(frag->node->size);
+		} else {
+			e->node = cpu_to_je32(JFFS2_INDEX_HOLE);
+			e->version = e->node_ofs = e->node_size = cpu_to_je32(0);
+		}
+	}
+	ri->data_crc = cpu_to_je32(crc32(0, ri->frags, nr * sizeof(*e)));
+	ri->node_crc = cpu_to_je32(crc32(0, ri, sizeof(*ri) - 8));
+
+	flash_ofs = write_ofs(c);
+	vec.iov_base = ri;
+	vec.iov_len = len;
+	ret = jffs2_flash_writev(c, &vec, 1, flash_ofs, &retlen, f->inocache->ino);
+	if (ret || retlen != len) {
+		printk(KERN_NOTICE "Write of %u bytes at 0x%08x failed. returned %d, retlen %zd\n",
+		       len, flash_ofs, ret, retlen);
+		if (retlen)
+			jffs2_add_physical_node_ref(c, flash_ofs | REF_OBSOLETE, PAD(len), NULL);
+		goto out_unlock;
+	}
+
+	jffs2_index_drop(c, f->inocache);
+	ref = jffs2_add_physical_node_ref(c, flash_ofs | REF_NORMAL, PAD(len), f->inocache);
+	if (!IS_ERR(ref))
+		f->inocache->index_ofs = flash_ofs | JFFS2_INDEX_PRESENT;
+
+	D1(printk(KERN_DEBUG "Wrote index node for ino #%u at 0x%08x, %u frags\n",
+		  f->inocache->ino, flash_ofs, nr));
+
+ out_unlock:
+	mutex_unlock(&f->sem);
+ out_complete:
+	jffs2_complete_reservation(c);
+ out_free:
+	kfree(ri);
+}
+
+/* Write index nodes for the inodes queued by read_inode() and GC */
+void jffs2_index_write_pending(struct jffs2_sb_info *c)
+{
+	uint32_t pending[JFFS2_INDEX_PENDING];
+	struct inode *inode;
+	int i, nr;
+
+	spin_lock(&c->inocache_lock);
+	nr = c->index_npending;
+	memcpy(pending, c->index_pending, nr * sizeof(pending[0]));
+	c->index_npending = 0;
+	spin_unlock(&c->inocache_lock);
+
+	for (i = 0; i < nr; i++) {
+		inode = ilookup(OFNI_BS_2SFFJ(c), pending[i]);
+		if (!inode)
+			continue;
+		/* Skip files being written to; the attributes of the
+		   in-core inode may be ahead of the flash */
+		if (mutex_trylock(&inode->i_mutex)) {
+			jffs2_write_inode_index(c, JFFS2_INODE_INFO(inode));
+			mutex_unlock(&inode->i_mutex);
+		}
+		iput(inode);
+	}
+}
@@ -0,0 +1,55 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * Inode index nodes: a checkpoint of the fragment map of a regular file.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ */
+
+#ifndef _JFFS2_FS_INDEX_H_
+#define _JFFS2_FS_INDEX_H_
+
+/* Low bits of jffs2_inode_cache->index_ofs, like the REF_* bits of
+   jffs2_raw_node_ref->flash_offset */
+#define JFFS2_INDEX_PRESENT	1	/* index_ofs is a live index node */
+#define JFFS2_INDEX_STALE	2	/* ... which no longer matches the inode */
+
+/* Don't bother for files with fewer fragments than this. Index nodes
+   also never describe more than fit into one eraseblock. */
+#define JFFS2_INDEX_MIN_FRAGS	16
+#define JFFS2_INDEX_MAX_FRAGS	1024
+
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+
+struct jffs2_sb_info;
+struct jffs2_inode_info;
+struct jffs2_inode_cache;
+struct jffs2_raw_node_ref;
+struct jffs2_raw_inode;
+
+void jffs2_index_scan_dnode(struct jffs2_inode_cache *ic, uint32_t version);
+void jffs2_index_scan_index(struct jffs2_inode_cache *ic, uint32_t ofs, uint32_t version);
+void jffs2_index_stale(struct jffs2_inode_cache *ic);
+void jffs2_index_drop(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic);
+int jffs2_index_gc(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+		   struct jffs2_raw_node_ref *raw);
+int jffs2_read_inode_index(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			   struct jffs2_raw_inode *latest_node);
+void jffs2_index_queue(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+void jffs2_index_write_pending(struct jffs2_sb_info *c);
+
+#else /* !CONFIG_JFFS2_FS_INODE_INDEX */
+
+#define jffs2_index_scan_dnode(ic, v)	do { } while (0)
+#define jffs2_index_scan_index(ic, o, v)	do { } while (0)
+#define jffs2_index_stale(ic)	do { } while (0)
+#define jffs2_index_drop(c, ic)	do { } while (0)
+#define jffs2_index_gc(c, f, raw)		(0)
+#define jffs2_read_inode_index(c, f, n)		(1)
+#define jffs2_index_queue(c, f)	do { } while (0)
+#define jffs2_index_write_pending(c)	do { } while (0)
+
+#endif /* CONFIG_JFFS2_FS_INODE_INDEX */
+
+#endif /* _JFFS2_FS_INDEX_H_ */
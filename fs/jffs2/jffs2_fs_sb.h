@@ -125,6 +125,13 @@ struct jffs2_sb_info {
 
 	struct jffs2_summary *summary;		/* Summary information */
 
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+#define JFFS2_INDEX_PENDING	32
+	/* Inodes to write an index node for at the next sync */
+	uint32_t index_pending[JFFS2_INDEX_PENDING];
+	int index_npending;
+#endif
+
 #ifdef CONFIG_JFFS2_FS_XATTR
 #define XATTRINDEX_HASHSIZE	(57)
 	uint32_t highest_xid;
@@ -20,6 +20,7 @@
 #include "xattr.h"
 #include "acl.h"
 #include "summary.h"
+#include "index.h"
 
 #ifdef __ECOS
 #include "os-ecos.h"
@@ -181,6 +182,10 @@ struct jffs2_inode_cache {
 				   here; other inodes store nlink.
 				   Zero always means that it's
 				   completely unlinked. */
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+	uint32_t index_ofs;	/* Index node, with JFFS2_INDEX_* flags */
+	uint32_t index_version;	/* Highest node version seen by the scan */
+#endif
 };
 
 /* Inode states for 'state' above. We need the 'GC' state to prevent
@@ -454,6 +454,7 @@ struct jffs2_raw_node_ref *jffs2_add_physical_node_ref(struct jffs2_sb_info *c,
 	spin_lock(&c->erase_completion_lock);
 
 	new = jffs2_link_node_ref(c, jeb, ofs, len, ic);
+	jffs2_index_stale(ic);
 
 	if (!jeb->free_size && !jeb->dirty_size && !ISDIRTY(jeb->wasted_size)) {
 		/* If it lives on the dirty_list, jffs2_reserve_space will put it there */
@@ -1104,6 +1104,16 @@ static int jffs2_get_inode_nodes(struct jffs2_sb_info *c, struct jffs2_inode_inf
 
 			break;
 
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+		case JFFS2_NODETYPE_INODE_INDEX:
+			/* We're reading all the nodes anyway, so whatever the
+			   index says is out of date */
+			dbg_readinode("obsoleting index node at %#08x\n", ref_offset(ref));
+			f->inocache->index_ofs = 0;
+			jffs2_mark_node_obsolete(c, ref);
+			break;
+#endif
+
 		default:
 			if (JFFS2_MIN_NODE_HEADER < sizeof(struct jffs2_unknown_node) &&
 			    len < sizeof(struct jffs2_unknown_node)) {
@@ -1151,6 +1161,13 @@ static int jffs2_do_read_inode_internal(struct jffs2_sb_info *c,
 	dbg_readinode("ino #%u pino/nlink is %d\n", f->inocache->ino,
 		      f->inocache->pino_nlink);
 
+	/* A large file may have an index node instead */
+	if (!jffs2_read_inode_index(c, f, latest_node)) {
+		if (f->inocache->state == INO_STATE_READING)
+			jffs2_set_inocache_state(c, f->inocache, INO_STATE_PRESENT);
+		return 0;
+	}
+
 	memset(&rii, 0, sizeof(rii));
 
 	/* Grab all nodes relevant to this ino */
@@ -1252,6 +1269,9 @@ static int jffs2_do_read_inode_internal(struct jffs2_sb_info *c,
 				      f->inocache->ino, je32_to_cpu(latest_node->isize), new_size);
 			latest_node->isize = cpu_to_je32(new_size);
 		}
+		/* Make reading it quicker next time */
+		if (f->inocache->state == INO_STATE_READING)
+			jffs2_index_queue(c, f);
 		break;
 
 	case S_IFLNK:
@@ -1439,6 +1459,9 @@ void jffs2_do_clear_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
 
 	jffs2_kill_fragtree(&f->fragtree, deleted?c:NULL);
 
+	if (deleted)
+		jffs2_index_drop(c, f->inocache);
+
 	if (f->target) {
 		kfree(f->target);
 		f->target = NULL;
@@ -45,6 +45,10 @@ static int jffs2_scan_inode_node(struct jffs2_sb_info *c, struct jffs2_erasebloc
 				 struct jffs2_raw_inode *ri, uint32_t ofs, struct jffs2_summary *s);
 static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 				 struct jffs2_raw_dirent *rd, uint32_t ofs, struct jffs2_summary *s);
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+static int jffs2_scan_index_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+				 struct jffs2_raw_inode_index *ri, uint32_t ofs, struct jffs2_summary *s);
+#endif
 
 static inline int min_free(struct jffs2_sb_info *c)
 {
@@ -834,6 +838,26 @@ scan_more:
 			break;
 #endif	/* CONFIG_JFFS2_FS_XATTR */
 
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+		case JFFS2_NODETYPE_INODE_INDEX:
+			if (buf_ofs + buf_len < ofs + sizeof(struct jffs2_raw_inode_index)) {
+				buf_len = min_t(uint32_t, buf_size, jeb->offset + c->sector_size - ofs);
+				D1(printk(KERN_DEBUG "Fewer than %zd bytes (index node)"
+					  " left to end of buf. Reading 0x%x at 0x%08x\n",
+					  sizeof(struct jffs2_raw_inode_index), buf_len, ofs));
+				err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+				if (err)
+					return err;
+				buf_ofs = ofs;
+				node = (void *)buf;
+			}
+			err = jffs2_scan_index_node(c, jeb, (void *)node, ofs, s);
+			if (err)
+				return err;
+			ofs += PAD(je32_to_cpu(node->totlen));
+			break;
+#endif
+
 		case JFFS2_NODETYPE_CLEANMARKER:
 			D1(printk(KERN_DEBUG "CLEANMARKER node found at 0x%08x\n", ofs));
 			if (je32_to_cpu(node->totlen) != c->cleanmarker_size) {
@@ -987,6 +1011,7 @@ static int jffs2_scan_inode_node(struct jffs2_sb_info *c, struct jffs2_erasebloc
 
 	/* Wheee. It worked */
 	jffs2_link_node_ref(c, jeb, ofs | REF_UNCHECKED, PAD(je32_to_cpu(ri->totlen)), ic);
+	jffs2_index_scan_dnode(ic, je32_to_cpu(ri->version));
 
 	D1(printk(KERN_DEBUG "Node is ino #%u, version %d. Range 0x%x-0x%x\n",
 		  je32_to_cpu(ri->ino), je32_to_cpu(ri->version),
@@ -1002,6 +1027,38 @@ static int jffs2_scan_inode_node(struct jffs2_sb_info *c, struct jffs2_erasebloc
 	return 0;
 }
 
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+static int jffs2_scan_index_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+				 struct jffs2_raw_inode_index *ri, uint32_t ofs, struct jffs2_summary *s)
+{
+	struct jffs2_inode_cache *ic;
+	uint32_t crc;
+
+	D1(printk(KERN_DEBUG "jffs2_scan_index_node(): Node at 0x%08x\n", ofs));
+
+	/* The fragment list is checked if and when the index gets used */
+	crc = crc32(0, ri, sizeof(*ri)-8);
+	if (crc != je32_to_cpu(ri->node_crc)) {
+		printk(KERN_NOTICE "jffs2_scan_index_node(): CRC failed on "
+		       "node at 0x%08x: Read 0x%08x, calculated 0x%08x\n",
+		       ofs, je32_to_cpu(ri->node_crc), crc);
+		return jffs2_scan_dirty_space(c, jeb, PAD(je32_to_cpu(ri->totlen)));
+	}
+
+	ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(ri->ino));
+	if (!ic)
+		return -ENOMEM;
+
+	jffs2_link_node_ref(c, jeb, ofs | REF_NORMAL, PAD(je32_to_cpu(ri->totlen)), ic);
+	jffs2_index_scan_index(ic, ofs, je32_to_cpu(ri->version));
+
+	if (jffs2_sum_active())
+		jffs2_sum_add_index_mem(s, ri, ofs - jeb->offset);
+
+	return 0;
+}
+#endif
+
 static int jffs2_scan_dirent_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
 				  struct jffs2_raw_dirent *rd, uint32_t ofs, struct jffs2_summary *s)
 {
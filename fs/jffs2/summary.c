@@ -73,6 +73,14 @@ static int jffs2_sum_add_mem(struct jffs2_summary *s, union jffs2_sum_mem *item)
 			dbg_summary("inode (%u) added to summary\n",
 						je32_to_cpu(item->i.inode));
 			break;
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+		case JFFS2_NODETYPE_INODE_INDEX:
+			s->sum_size += JFFS2_SUMMARY_INODE_SIZE;
+			s->sum_num++;
+			dbg_summary("index of inode (%u) added to summary\n",
+						je32_to_cpu(item->i.inode));
+			break;
+#endif
 		case JFFS2_NODETYPE_DIRENT:
 			s->sum_size += JFFS2_SUMMARY_DIRENT_SIZE(item->d.nsize);
 			s->sum_num++;
@@ -128,6 +136,25 @@ int jffs2_sum_add_inode_mem(struct jffs2_summary *s, struct jffs2_raw_inode *ri,
 	return jffs2_sum_add_mem(s, (union jffs2_sum_mem *)temp);
 }
 
+/* Index nodes use the same summary record as inode nodes */
+int jffs2_sum_add_index_mem(struct jffs2_summary *s, struct jffs2_raw_inode_index *ri,
+				uint32_t ofs)
+{
+	struct jffs2_sum_inode_mem *temp = kmalloc(sizeof(struct jffs2_sum_inode_mem), GFP_KERNEL);
+
+	if (!temp)
+		return -ENOMEM;
+
+	temp->nodetype = ri->nodetype;
+	temp->inode = ri->ino;
+	temp->version = ri->version;
+	temp->offset = cpu_to_je32(ofs);
+	temp->totlen = ri->totlen;
+	temp->next = NULL;
+
+	return jffs2_sum_add_mem(s, (union jffs2_sum_mem *)temp);
+}
+
 int jffs2_sum_add_dirent_mem(struct jffs2_summary *s, struct jffs2_raw_dirent *rd,
 				uint32_t ofs)
 {
@@ -276,6 +303,11 @@ int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
 			return jffs2_sum_add_mem(c->summary, (union jffs2_sum_mem *)temp);
 		}
 
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+		case JFFS2_NODETYPE_INODE_INDEX:
+			return jffs2_sum_add_index_mem(c->summary, &node->ii, ofs);
+#endif
+
 		case JFFS2_NODETYPE_DIRENT: {
 			struct jffs2_sum_dirent_mem *temp =
 				kmalloc(sizeof(struct jffs2_sum_dirent_mem) + node->d.nsize, GFP_KERNEL);
@@ -421,6 +453,7 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 
 				sum_link_node_ref(c, jeb, je32_to_cpu(spi->offset) | REF_UNCHECKED,
 						  PAD(je32_to_cpu(spi->totlen)), ic);
+				jffs2_index_scan_dnode(ic, je32_to_cpu(spi->version));
 
 				*pseudo_random += je32_to_cpu(spi->version);
 
@@ -429,6 +462,32 @@ static int jffs2_sum_process_sum_data(struct jffs2_sb_info *c, struct jffs2_eras
 				break;
 			}
 
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+			case JFFS2_NODETYPE_INODE_INDEX: {
+				struct jffs2_sum_inode_flash *spi;
+				spi = sp;
+
+				dbg_summary("Index at 0x%08x-0x%08x\n",
+					    jeb->offset + je32_to_cpu(spi->offset),
+					    jeb->offset + je32_to_cpu(spi->offset) + je32_to_cpu(spi->totlen));
+
+				ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(spi->inode));
+				if (!ic) {
+					JFFS2_NOTICE("scan_make_ino_cache failed\n");
+					return -ENOMEM;
+				}
+
+				sum_link_node_ref(c, jeb, je32_to_cpu(spi->offset) | REF_NORMAL,
+						  PAD(je32_to_cpu(spi->totlen)), ic);
+				jffs2_index_scan_index(ic, jeb->offset + je32_to_cpu(spi->offset),
+						       je32_to_cpu(spi->version));
+
+				sp += JFFS2_SUMMARY_INODE_SIZE;
+
+				break;
+			}
+#endif
+
 			case JFFS2_NODETYPE_DIRENT: {
 				struct jffs2_sum_dirent_flash *spd;
 				int checkedlen;
@@ -714,6 +773,9 @@ static int jffs2_sum_write_data(struct jffs2_sb_info *c, struct jffs2_eraseblock
 		temp = c->summary->sum_list_head;
 
 		switch (je16_to_cpu(temp->u.nodetype)) {
+#ifdef CONFIG_JFFS2_FS_INODE_INDEX
+			case JFFS2_NODETYPE_INODE_INDEX:
+#endif
 			case JFFS2_NODETYPE_INODE: {
 				struct jffs2_sum_inode_flash *sino_ptr = wpage;
 
@@ -73,6 +73,9 @@ static int jffs2_sync_fs(struct super_block *sb, int wait)
 {
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
 
+	if (!(sb->s_flags & MS_RDONLY))
+		jffs2_index_write_pending(c);
+
 	jffs2_write_super(sb);
 
 	mutex_lock(&c->alloc_sem);
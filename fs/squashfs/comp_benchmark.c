@@ -0,0 +1,245 @@
+/*
+ * Squashfs decompressor benchmark
+ *
+ * Reads a file, compresses it block by block with every decompressor
+ * squashfs supports that the kernel can also compress with (zlib at the
+ * mksquashfs default level, LZO1X-1), and reports the compression ratio
+ * and the compression and decompression throughput of each to the kernel
+ * log.  Decompression uses the same library calls as the squashfs
+ * wrappers, so the numbers compare images built with "mksquashfs -comp".
+ */
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/time.h>
+#include <linux/math64.h>
+#include <linux/zlib.h>
+#include <linux/lzo.h>
+
+static char *file = "/system/lib/libc.so";
+module_param(file, charp, 0444);
+MODULE_PARM_DESC(file, "file to compress");
+
+static int block_size = 131072;
+module_param(block_size, int, 0444);
+MODULE_PARM_DESC(block_size, "squashfs block size in bytes");
+
+static int max_kb = 4096;
+module_param(max_kb, int, 0444);
+MODULE_PARM_DESC(max_kb, "read at most this much of the file");
+
+static int loops = 4;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "decompression passes over the file");
+
+struct comp_bench {
+	const char	*name;
+	int		(*compress)(void *src, int len, void *dst, int *dst_len);
+	int		(*decompress)(void *src, int len, void *dst, int *dst_len);
+};
+
+static z_stream zstream;
+static void *lzo_wrkmem;
+
+static u64 elapsed_ns(struct timespec *start)
+{
+	struct timespec end;
+
+	getnstimeofday(&end);
+	return timespec_to_ns(&end) - timespec_to_ns(start);
+}
+
+static int zlib_bench_compress(void *src, int len, void *dst, int *dst_len)
+{
+	int err;
+
+	if (zlib_deflateInit(&zstream, 9) != Z_OK)
+		return -EINVAL;
+
+	zstream.next_in = src;
+	zstream.avail_in = len;
+	zstream.next_out = dst;
+	zstream.avail_out = *dst_len;
+	err = zlib_deflate(&zstream, Z_FINISH);
+	*dst_len = zstream.total_out;
+	zlib_deflateEnd(&zstream);
+
+	return err == Z_STREAM_END ? 0 : -EINVAL;
+}
+
+static int zlib_bench_decompress(void *src, int len, void *dst, int *dst_len)
+{
+	int err;
+
+	if (zlib_inflateInit(&zstream) != Z_OK)
+		return -EINVAL;
+
+	zstream.next_in = src;
+	zstream.avail_in = len;
+	zstream.next_out = dst;
+	zstream.avail_out = *dst_len;
+	err = zlib_inflate(&zstream, Z_SYNC_FLUSH);
+	*dst_len = zstream.total_out;
+	zlib_inflateEnd(&zstream);
+
+	return err == Z_STREAM_END ? 0 : -EINVAL;
+}
+
+static int lzo_bench_compress(void *src, int len, void *dst, int *dst_len)
+{
+	size_t out_len = *dst_len;
+
+	if (lzo1x_1_compress(src, len, dst, &out_len, lzo_wrkmem) != LZO_E_OK)
+		return -EINVAL;
+	*dst_len = out_len;
+	return 0;
+}
+
+static int lzo_bench_decompress(void *src, int len, void *dst, int *dst_len)
+{
+	size_t out_len = *dst_len;
+
+	if (lzo1x_decompress_safe(src, len, dst, &out_len) != LZO_E_OK)
+		return -EINVAL;
+	*dst_len = out_len;
+	return 0;
+}
+
+static struct comp_bench benches[] = {
+	{ "zlib", zlib_bench_compress, zlib_bench_decompress },
+	{ "lzo", lzo_bench_compress, lzo_bench_decompress },
+};
+
+/* MB (10^6 bytes) per second */
+static unsigned int mb_per_sec(u64 bytes, u64 ns)
+{
+	return ns ? div64_u64(bytes * 1000, ns) : 0;
+}
+
+static int run_bench(struct comp_bench *b, void *data, int size, void *comp,
+	int worst, int *comp_len, void *out)
+{
+	int nr = DIV_ROUND_UP(size, block_size);
+	struct timespec start;
+	u64 comp_ns, decomp_ns;
+	u64 total = 0;
+	int i, l, len, out_len;
+
+	getnstimeofday(&start);
+	for (i = 0; i < nr; i++) {
+		len = min(block_size, size - i * block_size);
+		comp_len[i] = worst;
+		if (b->compress(data + i * block_size, len, comp + i * worst,
+				&comp_len[i])) {
+			pr_err("squashfs_bench: %s compression failed\n",
+				b->name);
+			return -EINVAL;
+		}
+		total += comp_len[i];
+	}
+	comp_ns = elapsed_ns(&start);
+
+	/* check the round trip once, outside the timed loop */
+	for (i = 0; i < nr; i++) {
+		len = min(block_size, size - i * block_size);
+		out_len = block_size;
+		if (b->decompress(comp + i * worst, comp_len[i], out,
+				&out_len) || out_len != len ||
+				memcmp(out, data + i * block_size, len)) {
+			pr_err("squashfs_bench: %s round trip failed\n",
+				b->name);
+			return -EINVAL;
+		}
+	}
+
+	getnstimeofday(&start);
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < nr; i++) {
+			out_len = block_size;
+			b->decompress(comp + i * worst, comp_len[i], out,
+				&out_len);
+		}
+	}
+	decomp_ns = elapsed_ns(&start);
+
+	pr_info("squashfs_bench: %-4s ratio %llu.%llu%%, compress %u MB/s, "
+		"decompress %u MB/s\n", b->name,
+		div64_u64(total * 100, size),
+		div64_u64(total * 1000, size) % 10,
+		mb_per_sec(size, comp_ns),
+		mb_per_sec((u64)size * loops, decomp_ns));
+
+	return 0;
+}
+
+static int __init squashfs_bench_init(void)
+{
+	void *data = NULL, *comp = NULL, *out = NULL;
+	int *comp_len = NULL;
+	struct file *filp;
+	int size, nr, worst, i;
+	int ret = -ENOMEM;
+
+	if (block_size < PAGE_SIZE || loops < 1 || max_kb < 1)
+		return -EINVAL;
+
+	filp = filp_open(file, O_RDONLY, 0);
+	if (IS_ERR(filp)) {
+		pr_err("squashfs_bench: cannot open %s\n", file);
+		return PTR_ERR(filp);
+	}
+
+	size = min_t(loff_t, i_size_read(filp->f_path.dentry->d_inode),
+		(loff_t)max_kb * 1024);
+	nr = DIV_ROUND_UP(size, block_size);
+	worst = lzo1x_worst_compress(block_size);
+
+	data = vmalloc(size);
+	comp = vmalloc(nr * worst);
+	out = vmalloc(block_size);
+	comp_len = kcalloc(nr, sizeof(*comp_len), GFP_KERNEL);
+	zstream.workspace = vmalloc(max(zlib_deflate_workspacesize(),
+		zlib_inflate_workspacesize()));
+	lzo_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!size || !data || !comp || !out || !comp_len ||
+			!zstream.workspace || !lzo_wrkmem)
+		goto out;
+
+	ret = kernel_read(filp, 0, data, size);
+	if (ret != size) {
+		pr_err("squashfs_bench: short read of %s\n", file);
+		ret = -EIO;
+		goto out;
+	}
+
+	pr_info("squashfs_bench: %s, %d bytes in %d blocks of %d\n", file,
+		size, nr, block_size);
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		ret = run_bench(&benches[i], data, size, comp, worst, comp_len,
+			out);
+		if (ret)
+			break;
+	}
+
+out:
+	vfree(lzo_wrkmem);
+	vfree(zstream.workspace);
+	kfree(comp_len);
+	vfree(out);
+	vfree(comp);
+	vfree(data);
+	filp_close(filp, NULL);
+	return ret;
+}
+
+static void __exit squashfs_bench_exit(void)
+{
+}
+
+module_init(squashfs_bench_init);
+module_exit(squashfs_bench_exit);
+
+MODULE_DESCRIPTION("squashfs decompressor benchmark");
+MODULE_LICENSE("GPL");
@@ -23,7 +23,11 @@
 
 #include <linux/types.h>
 #include <linux/mutex.h>
+#include <linux/slab.h>
 #include <linux/buffer_head.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -36,13 +40,34 @@
  * Squashfs, allowing multiple decompressors to be easily supported
  */
 
+/*
+ * Each mounted filesystem keeps a pool of decompressor streams, so that
+ * blocks can be decompressed by several readers at once.  Streams are
+ * allocated on demand, up to two per online CPU (a decompressor may sleep
+ * waiting for its buffer_heads to be read), and kept until unmount.
+ */
+struct squashfs_stream {
+	struct list_head	list;
+	void			*stream;
+};
+
+struct squashfs_stream_pool {
+	struct list_head	idle;
+	spinlock_t		lock;
+	wait_queue_head_t	wait;
+	int			streams;
+	int			max_streams;
+};
+
 static const struct squashfs_decompressor squashfs_lzma_unsupported_comp_ops = {
 	NULL, NULL, NULL, LZMA_COMPRESSION, "lzma", 0
 };
 
-static const struct squashfs_decompressor squashfs_lzo_unsupported_comp_ops = {
+#ifndef CONFIG_SQUASHFS_LZO
+static const struct squashfs_decompressor squashfs_lzo_comp_ops = {
 	NULL, NULL, NULL, LZO_COMPRESSION, "lzo", 0
 };
+#endif
 
 static const struct squashfs_decompressor squashfs_unknown_comp_ops = {
 	NULL, NULL, NULL, 0, "unknown", 0
@@ -51,7 +76,7 @@ static const struct squashfs_decompressor squashfs_unknown_comp_ops = {
 static const struct squashfs_decompressor *decompressor[] = {
 	&squashfs_zlib_comp_ops,
 	&squashfs_lzma_unsupported_comp_ops,
-	&squashfs_lzo_unsupported_comp_ops,
+	&squashfs_lzo_comp_ops,
 	&squashfs_unknown_comp_ops
 };
 
@@ -66,3 +91,122 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 
 	return decompressor[i];
 }
+
+
+static struct squashfs_stream *alloc_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *strm = kmalloc(sizeof(*strm), GFP_KERNEL);
+
+	if (strm == NULL)
+		return NULL;
+
+	strm->stream = msblk->decompressor->init(msblk);
+	if (strm->stream == NULL) {
+		kfree(strm);
+		return NULL;
+	}
+
+	return strm;
+}
+
+
+void *squashfs_decompressor_init(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	struct squashfs_stream *strm;
+
+	if (pool == NULL)
+		return NULL;
+
+	INIT_LIST_HEAD(&pool->idle);
+	spin_lock_init(&pool->lock);
+	init_waitqueue_head(&pool->wait);
+	pool->max_streams = num_online_cpus() * 2;
+
+	/* One stream always exists, so a reader can always make progress */
+	strm = alloc_stream(msblk);
+	if (strm == NULL) {
+		kfree(pool);
+		return NULL;
+	}
+	list_add(&strm->list, &pool->idle);
+	pool->streams = 1;
+
+	return pool;
+}
+
+
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk, void *s)
+{
+	struct squashfs_stream_pool *pool = s;
+	struct squashfs_stream *strm, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(strm, next, &pool->idle, list) {
+		msblk->decompressor->free(strm->stream);
+		kfree(strm);
+	}
+	kfree(pool);
+}
+
+
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream_pool *pool)
+{
+	struct squashfs_stream *strm;
+
+	while (1) {
+		spin_lock(&pool->lock);
+		if (!list_empty(&pool->idle)) {
+			strm = list_entry(pool->idle.next,
+				struct squashfs_stream, list);
+			list_del(&strm->list);
+			spin_unlock(&pool->lock);
+			return strm;
+		}
+
+		if (pool->streams < pool->max_streams) {
+			pool->streams++;
+			spin_unlock(&pool->lock);
+
+			strm = alloc_stream(msblk);
+			if (strm)
+				return strm;
+
+			/* Out of memory, wait for one of the others */
+			spin_lock(&pool->lock);
+			pool->streams--;
+		}
+		spin_unlock(&pool->lock);
+
+		wait_event(pool->wait, !list_empty(&pool->idle));
+	}
+}
+
+
+static void put_stream(struct squashfs_stream_pool *pool,
+	struct squashfs_stream *strm)
+{
+	spin_lock(&pool->lock);
+	list_add(&strm->list, &pool->idle);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+	struct squashfs_stream *strm = get_stream(msblk, pool);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, strm->stream, buffer, bh,
+		b, offset, length, srclength, pages);
+	put_stream(pool, strm);
+
+	return res;
+}
@@ -47,6 +47,8 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -371,27 +373,120 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
-static int squashfs_readpage(struct file *file, struct page *page)
+/*
+ * Decompress a datablock straight into its page cache pages, instead of
+ * into a "data" cache entry that is then copied out.  This is only done
+ * when every page of the block can be had (locked by the caller or grabbed
+ * here without blocking, and not already uptodate), and when they are all
+ * in lowmem, so that they can be addressed without holding a kmap for
+ * each one while the block is read.  Returns -EAGAIN if the block has to
+ * go through the cache instead.
+ */
+static int squashfs_read_direct(struct inode *inode, u64 block, int bsize,
+	int start_index, int bytes, struct page **pages, int first, int nr)
 {
-	struct inode *inode = page->mapping->host;
+	struct address_space *mapping = inode->i_mapping;
+	int n = (bytes + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	struct page **page;
+	void **buffer;
+	int i, res = -EAGAIN, avail;
+
+	if (n == 0)
+		return -EAGAIN;
+
+	page = kcalloc(n, sizeof(*page) + sizeof(*buffer), GFP_KERNEL);
+	if (page == NULL)
+		return -EAGAIN;
+	buffer = (void **) (page + n);
+
+	for (i = 0; i < n; i++) {
+		int idx = start_index + i;
+
+		if (idx >= first && idx < first + nr && pages[idx - first])
+			page[i] = pages[idx - first];
+		else {
+			page[i] = grab_cache_page_nowait(mapping, idx);
+			if (page[i] == NULL)
+				goto release;
+			if (PageUptodate(page[i])) {
+				unlock_page(page[i]);
+				page_cache_release(page[i]);
+				page[i] = NULL;
+				goto release;
+			}
+		}
+		if (PageHighMem(page[i])) {
+			i++;
+			goto release;
+		}
+		buffer[i] = page_address(page[i]);
+	}
+
+	res = squashfs_read_data(inode->i_sb, buffer, block, bsize, NULL,
+		n << PAGE_CACHE_SHIFT, n);
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		res = -EIO;
+		goto release;
+	}
+
+	for (i = 0; i < n; i++) {
+		int idx = start_index + i;
+
+		avail = min_t(int, res - (i << PAGE_CACHE_SHIFT),
+			PAGE_CACHE_SIZE);
+		if (avail < PAGE_CACHE_SIZE)
+			memset(buffer[i] + max(avail, 0), 0,
+				PAGE_CACHE_SIZE - max(avail, 0));
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		unlock_page(page[i]);
+		if (idx >= first && idx < first + nr && pages[idx - first])
+			pages[idx - first] = NULL;
+		else
+			page_cache_release(page[i]);
+	}
+	kfree(page);
+	return 0;
+
+release:
+	/* Leave the caller's pages locked, give back the grabbed ones */
+	while (i-- > 0) {
+		int idx = start_index + i;
+
+		if (idx >= first && idx < first + nr && pages[idx - first])
+			continue;
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+	kfree(page);
+	return res;
+}
+
+
+/*
+ * Decompress datablock (or tail-end fragment) index of inode and fill its
+ * pages.  The caller may already hold some of the pages locked, these are
+ * passed in pages[], indexed from page first, and set to NULL as they are
+ * filled and unlocked.  The other pages of the block are grabbed from the
+ * page cache if that can be done without blocking.  On error the caller's
+ * pages are left locked.
+ */
+static int squashfs_fill_pages(struct inode *inode, int index,
+	struct page **pages, int first, int nr)
+{
+	struct address_space *mapping = inode->i_mapping;
 	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
 	int bytes, i, offset = 0, sparse = 0;
 	struct squashfs_cache_entry *buffer = NULL;
 	void *pageaddr;
 
 	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
-	int index = page->index >> (msblk->block_log - PAGE_CACHE_SHIFT);
-	int start_index = page->index & ~mask;
+	int start_index = index << (msblk->block_log - PAGE_CACHE_SHIFT);
 	int end_index = start_index | mask;
 	int file_end = i_size_read(inode) >> msblk->block_log;
 
-	TRACE("Entered squashfs_readpage, page index %lx, start block %llx\n",
-				page->index, squashfs_i(inode)->start);
-
-	if (page->index >= ((i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
-					PAGE_CACHE_SHIFT))
-		goto out;
-
 	if (index < file_end || squashfs_i(inode)->fragment_block ==
 					SQUASHFS_INVALID_BLK) {
 		/*
@@ -401,7 +496,7 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		u64 block = 0;
 		int bsize = read_blocklist(inode, index, &block);
 		if (bsize < 0)
-			goto error_out;
+			return bsize;
 
 		if (bsize == 0) { /* hole */
 			bytes = index == file_end ?
@@ -410,15 +505,23 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Read and decompress datablock, directly into the
+			 * page cache if possible.
 			 */
+			int res = squashfs_read_direct(inode, block, bsize,
+				start_index, index == file_end ?
+				(i_size_read(inode) & (msblk->block_size - 1)) :
+				msblk->block_size, pages, first, nr);
+			if (res != -EAGAIN)
+				return res;
+
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
 			if (buffer->error) {
 				ERROR("Unable to read page, block %llx, size %x"
 					"\n", block, bsize);
 				squashfs_cache_put(buffer);
-				goto error_out;
+				return -EIO;
 			}
 			bytes = buffer->length;
 		}
@@ -436,7 +539,7 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				squashfs_i(inode)->fragment_block,
 				squashfs_i(inode)->fragment_size);
 			squashfs_cache_put(buffer);
-			goto error_out;
+			return -EIO;
 		}
 		bytes = i_size_read(inode) & (msblk->block_size - 1);
 		offset = squashfs_i(inode)->fragment_offset;
@@ -445,24 +548,27 @@ static int squashfs_readpage(struct file *file, struct page *page)
 	/*
 	 * Loop copying datablock into pages.  As the datablock likely covers
 	 * many PAGE_CACHE_SIZE pages (default block size is 128 KiB) explicitly
-	 * grab the pages from the page cache, except for the page that we've
+	 * grab the pages from the page cache, except for the pages that we've
 	 * been called to fill.
 	 */
 	for (i = start_index; i <= end_index && bytes > 0; i++,
 			bytes -= PAGE_CACHE_SIZE, offset += PAGE_CACHE_SIZE) {
-		struct page *push_page;
+		struct page *push_page = NULL;
 		int avail = sparse ? 0 : min_t(int, bytes, PAGE_CACHE_SIZE);
 
 		TRACE("bytes %d, i %d, available_bytes %d\n", bytes, i, avail);
 
-		push_page = (i == page->index) ? page :
-			grab_cache_page_nowait(page->mapping, i);
-
-		if (!push_page)
-			continue;
-
-		if (PageUptodate(push_page))
-			goto skip_page;
+		if (i >= first && i < first + nr) {
+			push_page = pages[i - first];
+			pages[i - first] = NULL;
+		}
+		if (!push_page) {
+			push_page = grab_cache_page_nowait(mapping, i);
+			if (!push_page)
+				continue;
+			if (PageUptodate(push_page))
+				goto skip_page;
+		}
 
 		pageaddr = kmap_atomic(push_page, KM_USER0);
 		squashfs_copy_data(pageaddr, buffer, offset, avail);
@@ -472,7 +578,7 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		SetPageUptodate(push_page);
 skip_page:
 		unlock_page(push_page);
-		if (i != page->index)
+		if (i < first || i >= first + nr)
 			page_cache_release(push_page);
 	}
 
@@ -480,8 +586,28 @@ skip_page:
 		squashfs_cache_put(buffer);
 
 	return 0;
+}
+
+
+static int squashfs_readpage(struct file *file, struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int index = page->index >> (msblk->block_log - PAGE_CACHE_SHIFT);
+	struct page *owned = page;
+	void *pageaddr;
+
+	TRACE("Entered squashfs_readpage, page index %lx, start block %llx\n",
+				page->index, squashfs_i(inode)->start);
+
+	if (page->index >= ((i_size_read(inode) + PAGE_CACHE_SIZE - 1) >>
+					PAGE_CACHE_SHIFT))
+		goto out;
+
+	squashfs_fill_pages(inode, index, &owned, page->index, 1);
+	if (owned == NULL)
+		return 0;
 
-error_out:
 	SetPageError(page);
 out:
 	pageaddr = kmap_atomic(page, KM_USER0);
@@ -496,6 +622,126 @@ out:
 }
 
 
+/*
+ * Readahead.  The pages asked for are grouped by datablock, the first
+ * datablock is decompressed by the caller and the others are queued on
+ * squashfs_read_wq, spread over the online CPUs, so that they decompress
+ * in parallel.  Pages that cannot be filled are unlocked without being
+ * marked uptodate, and will be read again by squashfs_readpage() if they
+ * are needed.  Each queued work item holds a reference to the inode until
+ * it is done, as nothing else keeps the inode around once the caller has
+ * returned.
+ */
+struct workqueue_struct *squashfs_read_wq;
+
+struct squashfs_read_work {
+	struct work_struct	work;
+	struct list_head	list;
+	struct inode		*inode;
+	int			index;
+	int			first;
+	int			nr;
+	struct page		*pages[0];
+};
+
+static void squashfs_read_block(struct squashfs_read_work *rw)
+{
+	int i;
+
+	squashfs_fill_pages(rw->inode, rw->index, rw->pages, rw->first,
+		rw->nr);
+
+	for (i = 0; i < rw->nr; i++)
+		if (rw->pages[i])
+			unlock_page(rw->pages[i]);
+
+	kfree(rw);
+}
+
+
+static void squashfs_read_work(struct work_struct *work)
+{
+	struct squashfs_read_work *rw =
+		container_of(work, struct squashfs_read_work, work);
+	struct inode *inode = rw->inode;
+
+	squashfs_read_block(rw);
+	iput(inode);
+}
+
+
+static int squashfs_readpages(struct file *file, struct address_space *mapping,
+	struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int shift = msblk->block_log - PAGE_CACHE_SHIFT;
+	struct squashfs_read_work *rw = NULL, *first, *next;
+	LIST_HEAD(work_list);
+	int cpu;
+
+	/* The page list is in reverse order, lowest page index last */
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+		int index = page->index >> shift;
+
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+				GFP_KERNEL)) {
+			page_cache_release(page);
+			continue;
+		}
+		/*
+		 * The page cache holds the page now, and it stays there while
+		 * it is locked.
+		 */
+		page_cache_release(page);
+
+		if (rw == NULL || rw->index != index) {
+			rw = kzalloc(sizeof(*rw) + (sizeof(struct page *) <<
+				shift), GFP_KERNEL);
+			if (rw == NULL) {
+				unlock_page(page);
+				continue;
+			}
+			INIT_WORK(&rw->work, squashfs_read_work);
+			rw->inode = inode;
+			rw->index = index;
+			rw->first = index << shift;
+			rw->nr = 1 << shift;
+			list_add_tail(&rw->list, &work_list);
+		}
+		rw->pages[page->index - rw->first] = page;
+	}
+
+	if (list_empty(&work_list))
+		return 0;
+
+	first = list_first_entry(&work_list, struct squashfs_read_work, list);
+	list_del(&first->list);
+
+	get_online_cpus();
+	cpu = raw_smp_processor_id();
+	list_for_each_entry_safe(rw, next, &work_list, list) {
+		list_del(&rw->list);
+		if (!igrab(inode)) {
+			squashfs_read_block(rw);
+			continue;
+		}
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		queue_work_on(cpu, squashfs_read_wq, &rw->work);
+	}
+	put_online_cpus();
+
+	squashfs_read_block(first);
+
+	return 0;
+}
+
+
 const struct address_space_operations squashfs_aops = {
-	.readpage = squashfs_readpage
+	.readpage = squashfs_readpage,
+	.readpages = squashfs_readpages
 };
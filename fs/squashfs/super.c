@@ -37,6 +37,7 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/workqueue.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -105,7 +106,6 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	msblk->devblksize = sb_min_blocksize(sb, BLOCK_SIZE);
 	msblk->devblksize_log2 = ffz(~msblk->devblksize);
 
-	mutex_init(&msblk->read_data_mutex);
 	mutex_init(&msblk->meta_index_mutex);
 
 	/*
@@ -209,8 +209,9 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
-	/* Allocate read_page block */
-	msblk->read_page = squashfs_cache_init("data", 1, msblk->block_size);
+	/* Allocate read_page blocks */
+	msblk->read_page = squashfs_cache_init("data",
+		SQUASHFS_CACHED_DATABLOCKS, msblk->block_size);
 	if (msblk->read_page == NULL) {
 		ERROR("Failed to allocate read_page block\n");
 		goto failed_mount;
@@ -354,6 +355,9 @@ static int squashfs_remount(struct super_block *sb, int *flags, char *data)
 
 static void squashfs_put_super(struct super_block *sb)
 {
+	/* Readahead still running against this filesystem */
+	flush_workqueue(squashfs_read_wq);
+
 	lock_kernel();
 
 	if (sb->s_fs_info) {
@@ -418,8 +422,15 @@ static int __init init_squashfs_fs(void)
 	if (err)
 		return err;
 
+	squashfs_read_wq = create_workqueue("squashfs");
+	if (squashfs_read_wq == NULL) {
+		destroy_inodecache();
+		return -ENOMEM;
+	}
+
 	err = register_filesystem(&squashfs_fs_type);
 	if (err) {
+		destroy_workqueue(squashfs_read_wq);
 		destroy_inodecache();
 		return err;
 	}
@@ -434,6 +445,7 @@ static int __init init_squashfs_fs(void)
 static void __exit exit_squashfs_fs(void)
 {
 	unregister_filesystem(&squashfs_fs_type);
+	destroy_workqueue(squashfs_read_wq);
 	destroy_inodecache();
 }
 
@@ -87,6 +87,7 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in);
 
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in);
 static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId);
+static void yaffs_FreeChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache);
 
 static int yaffs_FindChunkInFile(yaffs_Object *in, int chunkInInode,
 				yaffs_ExtendedTags *tags);
@@ -2538,6 +2539,21 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
  * The idea is to help clear out space in a more spread-out manner.
  * Dunno if it really does anything useful.
  */
+static void yaffs_UpdateGCTime(yaffs_Device *dev, int background, __u32 us)
+{
+	if (background) {
+		dev->bgGCCalls++;
+		dev->bgGCTime += us;
+		if (us > dev->bgGCMaxTime)
+			dev->bgGCMaxTime = us;
+	} else {
+		dev->fgGCCalls++;
+		dev->fgGCTime += us;
+		if (us > dev->fgGCMaxTime)
+			dev->fgGCMaxTime = us;
+	}
+}
+
 static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 {
 	int aggressive = 0;
@@ -2546,9 +2562,13 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 	int minErased;
 	int erasedChunks;
 	int checkpointBlockAdjust;
+	unsigned gcControl = 1;
+	__u32 gcStart;
+
+	if(dev->param.gcControl)
+		gcControl = dev->param.gcControl(dev);
 
-	if(dev->param.gcControl &&
-		(dev->param.gcControl(dev) & 1) == 0)
+	if((gcControl & 1) == 0)
 		return YAFFS_OK;
 
 	if (dev->gcDisable) {
@@ -2575,6 +2595,14 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 			if(!background && erasedChunks > (dev->nFreeChunks / 4))
 				break;
 
+			/* Leave passive collection to the background thread */
+			if(!background && (gcControl & 2)){
+				dev->fgGCDeferred++;
+				if(dev->param.wakeBackgroundGC)
+					dev->param.wakeBackgroundGC(dev);
+				break;
+			}
+
 			if(dev->gcSkip > 20)
 				dev->gcSkip = 20;
 			if(erasedChunks < dev->nFreeChunks/2 ||
@@ -2612,7 +2640,9 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 			   ("yaffs: GC erasedBlocks %d aggressive %d" TENDSTR),
 			   dev->nErasedBlocks, aggressive));
 
+			gcStart = Y_TIME_US();
 			gcOk = yaffs_GarbageCollectBlock(dev, dev->gcBlock, aggressive);
+			yaffs_UpdateGCTime(dev, background, Y_TIME_US() - gcStart);
 		}
 
 		if (dev->nErasedBlocks < (dev->param.nReservedBlocks) && dev->gcBlock > 0) {
@@ -2631,6 +2661,7 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev, int background)
 /*
  * yaffs_BackgroundGarbageCollect()
  * Garbage collects. Intended to be called from a background thread.
+ * Urgency 0 means there is nothing worth collecting yet.
  * Returns non-zero if at least half the free chunks are erased.
  */
 int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, unsigned urgency)
@@ -2639,7 +2670,8 @@ int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, unsigned urgency)
 
 	T(YAFFS_TRACE_BACKGROUND, (TSTR("Background gc %u" TENDSTR),urgency));
 
-	yaffs_CheckGarbageCollection(dev, 1);
+	if (urgency)
+		yaffs_CheckGarbageCollection(dev, 1);
 	return erasedChunks > dev->nFreeChunks/2;
 }
 
@@ -3233,8 +3265,7 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 								 cache->data,
 								 cache->nBytes,
 								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+				yaffs_FreeChunkCache(dev, cache);
 			}
 
 		} while (cache && chunkWritten > 0);
@@ -3279,74 +3310,80 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 }
 
 
+/* Hash of an (object, chunk) pair into dev->srCacheHash. Consecutive chunks
+ * of one file go to consecutive buckets.
+ */
+static Y_INLINE struct ylist_head *yaffs_ChunkCacheBucket(yaffs_Device *dev,
+					const yaffs_Object *obj, int chunkId)
+{
+	__u32 h = (__u32)obj->objectId * 0x9E3779B1U + (__u32)chunkId;
+
+	return &dev->srCacheHash[h & dev->srCacheHashMask];
+}
+
 /* Grab us a cache chunk for use.
  * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Then take the least recently used one if it is clean, otherwise flush
+ * the object it belongs to and look again.
+ * The returned entry is hashed for obj and chunkId and is the most recently
+ * used one.
  */
 static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
 {
-	int i;
+	yaffs_ChunkCache *cache;
 
-	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
-	}
+	if (ylist_empty(&dev->srCacheFree))
+		return NULL;
 
-	return NULL;
+	cache = ylist_entry(dev->srCacheFree.next, yaffs_ChunkCache, lruLink);
+	ylist_del_init(&cache->lruLink);
+	return cache;
 }
 
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev,
+					yaffs_Object *obj, int chunkId)
 {
-	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
-
-	if (dev->param.nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
-		cache = yaffs_GrabChunkCacheWorker(dev);
+	yaffs_ChunkCache *cache = NULL;
+	struct ylist_head *i;
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	if (dev->param.nShortOpCaches <= 0)
+		return NULL;
 
-			/* With locking we can't assume we can use entry zero */
+	cache = yaffs_GrabChunkCacheWorker(dev);
 
-			theObj = NULL;
-			usage = -1;
+	if (!cache) {
+		/* None free. With locking we can't assume the least recently
+		 * used one can be pushed out, so take the first unlocked one.
+		 */
+		ylist_for_each(i, &dev->srCacheLru) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (!cache->locked)
+				break;
 			cache = NULL;
-			pushout = -1;
-
-			for (i = 0; i < dev->param.nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
-
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+		}
 
+		if (cache && !cache->dirty) {
+			ylist_del_init(&cache->hashLink);
+			ylist_del_init(&cache->lruLink);
+		} else {
+			/* Flush and try again.
+			 * NB this flushes every dirty chunk of the object
+			 * owning the least recently used chunk.
+			 */
+			if (cache)
+				yaffs_FlushFilesChunkCache(cache->object);
+			cache = yaffs_GrabChunkCacheWorker(dev);
 		}
-		return cache;
-	} else
-		return NULL;
+	}
 
+	if (cache) {
+		cache->object = obj;
+		cache->chunkId = chunkId;
+		ylist_add(&cache->hashLink,
+			  yaffs_ChunkCacheBucket(dev, obj, chunkId));
+		ylist_add_tail(&cache->lruLink, &dev->srCacheLru);
+	}
+	return cache;
 }
 
 /* Find a cached chunk */
@@ -3354,16 +3391,19 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	yaffs_ChunkCache *cache;
+	struct ylist_head *i;
+
 	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
+		ylist_for_each(i, yaffs_ChunkCacheBucket(dev, obj, chunkId)) {
+			cache = ylist_entry(i, yaffs_ChunkCache, hashLink);
+			if (cache->object == obj &&
+			    cache->chunkId == chunkId) {
 				dev->cacheHits++;
-
-				return &dev->srCache[i];
+				return cache;
 			}
 		}
+		dev->cacheMisses++;
 	}
 	return NULL;
 }
@@ -3374,24 +3414,24 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 {
 
 	if (dev->param.nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
-		}
-
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
+		ylist_del(&cache->lruLink);
+		ylist_add_tail(&cache->lruLink, &dev->srCacheLru);
 
 		if (isAWrite)
 			cache->dirty = 1;
 	}
 }
 
+/* Put a cache entry back on the free list, dropping its data. */
+static void yaffs_FreeChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	cache->object = NULL;
+	cache->dirty = 0;
+	ylist_del_init(&cache->hashLink);
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srCacheFree);
+}
+
 /* Invalidate a single cache page.
  * Do this when a whole page gets written,
  * ie the short cache for this page is no longer valid.
@@ -3402,7 +3442,7 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_FreeChunkCache(object->myDev, cache);
 	}
 }
 
@@ -3418,7 +3458,7 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->param.nShortOpCaches; i++) {
 			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+				yaffs_FreeChunkCache(dev, &dev->srCache[i]);
 		}
 	}
 }
@@ -3475,9 +3515,8 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 				/* If we can't find the data in the cache, then load it up. */
 
 				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					cache = yaffs_GrabChunkCache(in->myDev,
+								     in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -3602,9 +3641,8 @@ int yaffs_DoWriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(dev, 1)) {
-					cache = yaffs_GrabChunkCache(dev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					cache = yaffs_GrabChunkCache(dev,
+								in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -5270,6 +5308,13 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->passiveGCs = 0;
 	dev->oldestDirtyGCs = 0;
 	dev->backgroundGCs = 0;
+	dev->fgGCCalls = 0;
+	dev->fgGCMaxTime = 0;
+	dev->fgGCTime = 0;
+	dev->bgGCCalls = 0;
+	dev->bgGCMaxTime = 0;
+	dev->bgGCTime = 0;
+	dev->fgGCDeferred = 0;
 	dev->gcBlockFinder = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
@@ -5296,35 +5341,53 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->gcCleanupList = NULL;
 
 
+	dev->srCacheHash = NULL;
+	YINIT_LIST_HEAD(&dev->srCacheLru);
+	YINIT_LIST_HEAD(&dev->srCacheFree);
+
 	if (!init_failed &&
 	    dev->param.nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
+		unsigned nBuckets = 1;
 
 		if (dev->param.nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
 		dev->srCache =  YMALLOC(srCacheBytes);
 
+		/* About one entry per bucket */
+		while (nBuckets < dev->param.nShortOpCaches)
+			nBuckets <<= 1;
+		dev->srCacheHash = YMALLOC(nBuckets * sizeof(struct ylist_head));
+		dev->srCacheHashMask = nBuckets - 1;
+
 		buf = (__u8 *) dev->srCache;
+		if (!dev->srCacheHash)
+			buf = NULL;
 
 		if (dev->srCache)
 			memset(dev->srCache, 0, srCacheBytes);
 
+		for (i = 0; i < nBuckets && buf; i++)
+			YINIT_LIST_HEAD(&dev->srCacheHash[i]);
+
 		for (i = 0; i < dev->param.nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
 			dev->srCache[i].dirty = 0;
+			YINIT_LIST_HEAD(&dev->srCache[i].hashLink);
+			ylist_add_tail(&dev->srCache[i].lruLink,
+				       &dev->srCacheFree);
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->param.totalBytesPerChunk);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->param.nChunksPerBlock * sizeof(__u32));
@@ -5438,6 +5501,9 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			YFREE(dev->srCache);
 			dev->srCache = NULL;
 		}
+		if (dev->srCacheHash)
+			YFREE(dev->srCacheHash);
+		dev->srCacheHash = NULL;
 
 		YFREE(dev->gcCleanupList);
 
@@ -64,7 +64,7 @@
 #define YAFFS_OBJECT_SPACE		0x40000
 #define YAFFS_MAX_OBJECT_ID		(YAFFS_OBJECT_SPACE -1)
 
-#define YAFFS_CHECKPOINT_VERSION 	4
+#define YAFFS_CHECKPOINT_VERSION 	5
 
 #ifdef CONFIG_YAFFS_UNICODE
 #define YAFFS_MAX_NAME_LENGTH		127
@@ -88,7 +88,7 @@
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	256
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -111,11 +111,15 @@
 /* Special sequence number for bad block that failed to be marked bad */
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
-/* ChunkCache is used for short read/write operations.*/
+/* ChunkCache is used for short read/write operations.
+ * Entries in use are hashed by (object, chunkId) and kept on an LRU list,
+ * least recently used first. Unused entries are on the free list.
+ */
 typedef struct {
+	struct ylist_head hashLink;
+	struct ylist_head lruLink;	/* LRU or free list */
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -575,6 +579,17 @@ struct yaffs_DeviceParamStruct {
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
+
+	/* Optional: read the tags of every chunk of nBlocks blocks into
+	 * tags[], nChunksPerBlock entries per block, using up to nScanThreads
+	 * threads. Used by the yaffs2 scan to read ahead. mtdEcc[] gets the
+	 * ECC result the driver itself reported for each chunk, so that the
+	 * scan can update the ECC counters as readChunkWithTagsFromNAND would.
+	 */
+	int (*readBlockTagsFromNAND) (struct yaffs_DeviceStruct *dev,
+				      const int *blocks, int nBlocks,
+				      yaffs_ExtendedTags *tags, __u8 *mtdEcc);
+	int nScanThreads;
 #endif
 
 	/* The removeObjectCallback function must be supplied by OS flavours that
@@ -587,8 +602,14 @@ struct yaffs_DeviceParamStruct {
 	/* Callback to mark the superblock dirty */
 	void (*markSuperBlockDirty)(struct yaffs_DeviceStruct *dev);
 	
-	/*  Callback to control garbage collection. */
+	/*  Callback to control garbage collection.
+	 *  Bit 0: garbage collection is enabled.
+	 *  Bit 1: a background thread does passive collection, so writers
+	 *         only collect when they are short of erased blocks and call
+	 *         wakeBackgroundGC instead.
+	 */
 	unsigned (*gcControl)(struct yaffs_DeviceStruct *dev);
+	void (*wakeBackgroundGC)(struct yaffs_DeviceStruct *dev);
 
         /* Debug control flags. Don't use unless you know what you're doing */
 	int useHeaderFileSize;	/* Flag to determine if we should use file sizes from the header */
@@ -719,7 +740,10 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	struct ylist_head *srCacheHash;
+	unsigned srCacheHashMask;
+	struct ylist_head srCacheLru;
+	struct ylist_head srCacheFree;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -769,6 +793,17 @@ struct yaffs_DeviceStruct {
 	__u32 nUnmarkedDeletions;
 	__u32 refreshCount;
 	__u32 cacheHits;
+	__u32 cacheMisses;
+	__u32 checkpointGeneration;
+
+	/* Time spent collecting, in us */
+	__u32 fgGCCalls;
+	__u32 fgGCMaxTime;
+	__u64 fgGCTime;
+	__u32 bgGCCalls;
+	__u32 bgGCMaxTime;
+	__u64 bgGCTime;
+	__u32 fgGCDeferred;	/* Passive collections left to the background */
 
 };
 
@@ -801,6 +836,7 @@ typedef struct {
 
 	/* yaffs2 runtime stuff */
 	unsigned sequenceNumber;	/* Sequence number of currently allocating block */
+	__u32 checkpointGeneration;	/* Checkpoints written since the last scan */
 
 } yaffs_CheckpointDevice;
 
@@ -25,6 +25,7 @@ struct yaffs_LinuxContext {
 	struct super_block * superBlock;
 	struct task_struct *bgThread; /* Background thread for this device */
 	int bgRunning;
+	int bgGCWanted;		/* A writer deferred gc to the background thread */
         struct semaphore grossLock;     /* Gross locking semaphore */
 	__u8 *spareBuffer;      /* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
@@ -34,6 +35,9 @@ struct yaffs_LinuxContext {
 
 	struct task_struct *readdirProcess;
 	unsigned mount_id;
+
+	unsigned mountTime;		/* ms spent in yaffs_GutsInitialise */
+	int mountFromCheckpoint;
 };
 
 #define yaffs_DeviceToLC(dev) ((struct yaffs_LinuxContext *)((dev)->osContext))
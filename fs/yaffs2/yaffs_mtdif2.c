@@ -21,6 +21,8 @@
 #include "linux/mtd/mtd.h"
 #include "linux/types.h"
 #include "linux/time.h"
+#include "linux/async.h"
+#include "linux/slab.h"
 
 #include "yaffs_packedtags2.h"
 
@@ -255,3 +257,126 @@ int nandmtd2_QueryNANDBlock(struct yaffs_DeviceStruct *dev, int blockNo,
 		return YAFFS_FAIL;
 }
 
+#if (MTD_VERSION_CODE > MTD_VERSION(2, 6, 17))
+/* Reads tags only, into a private oob buffer so that several of these can
+ * run at the same time. Counters and bad block handling are left to the
+ * caller; the ECC result the driver reported, where it changed the tags'
+ * result, is returned for the counters.
+ */
+static __u8 nandmtd2_ReadTags(yaffs_Device *dev, struct mtd_info *mtd,
+			int chunkInNAND, yaffs_ExtendedTags *tags, __u8 *oob)
+{
+	struct mtd_oob_ops ops;
+	yaffs_PackedTags2 pt;
+	int packed_tags_size = dev->param.noTagsECC ? sizeof(pt.t) : sizeof(pt);
+	void *packed_tags_ptr = dev->param.noTagsECC ? (void *) &pt.t : (void *)&pt;
+	int retval;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = packed_tags_size;
+	ops.len = packed_tags_size;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = oob;
+	retval = mtd->read_oob(mtd,
+			((loff_t) chunkInNAND) * dev->param.totalBytesPerChunk,
+			&ops);
+
+	memcpy(packed_tags_ptr, oob, packed_tags_size);
+	yaffs_UnpackTags2(tags, &pt, !dev->param.noTagsECC);
+
+	if (tags->eccResult != YAFFS_ECC_RESULT_NO_ERROR)
+		return YAFFS_ECC_RESULT_NO_ERROR;
+	if (retval == -EBADMSG)
+		tags->eccResult = YAFFS_ECC_RESULT_UNFIXED;
+	else if (retval == -EUCLEAN)
+		tags->eccResult = YAFFS_ECC_RESULT_FIXED;
+	return tags->eccResult;
+}
+
+typedef struct {
+	yaffs_Device *dev;
+	const int *blocks;
+	int nBlocks;
+	yaffs_ExtendedTags *tags;
+	__u8 *mtdEcc;
+	int result;
+} nandmtd2_TagsWork;
+
+static void nandmtd2_ReadBlockTagsWorker(void *data, async_cookie_t cookie)
+{
+	nandmtd2_TagsWork *work = data;
+	yaffs_Device *dev = work->dev;
+	struct mtd_info *mtd = yaffs_DeviceToMtd(dev);
+	int nChunks = dev->param.nChunksPerBlock;
+	__u8 *oob;
+	int b, c;
+
+	oob = kmalloc(mtd->oobsize, GFP_NOFS);
+	if (!oob) {
+		work->result = YAFFS_FAIL;
+		return;
+	}
+
+	for (b = 0; b < work->nBlocks; b++) {
+		for (c = 0; c < nChunks; c++)
+			work->mtdEcc[b * nChunks + c] = nandmtd2_ReadTags(dev,
+				mtd, work->blocks[b] * nChunks + c - dev->chunkOffset,
+				&work->tags[b * nChunks + c], oob);
+	}
+
+	kfree(oob);
+	work->result = YAFFS_OK;
+}
+
+/* Read the tags of all chunks of the given blocks, spreading the blocks
+ * over up to nScanThreads async threads.
+ */
+int nandmtd2_ReadBlockTagsFromNAND(yaffs_Device *dev, const int *blocks,
+				int nBlocks, yaffs_ExtendedTags *tags,
+				__u8 *mtdEcc)
+{
+	LIST_HEAD(domain);
+	nandmtd2_TagsWork *work;
+	int nThreads = dev->param.nScanThreads;
+	int perThread;
+	int i, first;
+	int retval = YAFFS_OK;
+
+	if (nThreads > nBlocks)
+		nThreads = nBlocks;
+	if (nThreads < 1)
+		return YAFFS_FAIL;
+
+	work = kcalloc(nThreads, sizeof(*work), GFP_NOFS);
+	if (!work)
+		return YAFFS_FAIL;
+
+	perThread = (nBlocks + nThreads - 1) / nThreads;
+	for (i = 0, first = 0; i < nThreads && first < nBlocks; i++) {
+		work[i].dev = dev;
+		work[i].blocks = &blocks[first];
+		work[i].nBlocks = min(perThread, nBlocks - first);
+		work[i].tags = &tags[first * dev->param.nChunksPerBlock];
+		work[i].mtdEcc = &mtdEcc[first * dev->param.nChunksPerBlock];
+		async_schedule_domain(nandmtd2_ReadBlockTagsWorker, &work[i],
+				      &domain);
+		first += work[i].nBlocks;
+	}
+	async_synchronize_full_domain(&domain);
+
+	while (i-- > 0) {
+		if (work[i].result != YAFFS_OK)
+			retval = YAFFS_FAIL;
+	}
+	kfree(work);
+	return retval;
+}
+#else
+int nandmtd2_ReadBlockTagsFromNAND(yaffs_Device *dev, const int *blocks,
+				int nBlocks, yaffs_ExtendedTags *tags,
+				__u8 *mtdEcc)
+{
+	return YAFFS_FAIL;
+}
+#endif
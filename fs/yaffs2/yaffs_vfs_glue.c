@@ -173,16 +173,32 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS | YAFFS_TRACE_ALWAYS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
+/* Threads reading tags ahead while scanning a yaffs2 device */
+unsigned int yaffs_scan_threads = 4;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
+/* Background gc runs while less than yaffs_bg_gc_soft percent of the free
+ * space is erased and hurries below yaffs_bg_gc_hard percent. Once the device
+ * has seen no writes for yaffs_bg_idle_ms it keeps going up to
+ * yaffs_bg_gc_idle percent.
+ */
+unsigned int yaffs_bg_gc_soft = 50;
+unsigned int yaffs_bg_gc_hard = 25;
+unsigned int yaffs_bg_gc_idle = 75;
+unsigned int yaffs_bg_idle_ms = 500;
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 module_param(yaffs_traceMask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
+module_param(yaffs_scan_threads, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_bg_gc_soft, uint, 0644);
+module_param(yaffs_bg_gc_hard, uint, 0644);
+module_param(yaffs_bg_gc_idle, uint, 0644);
+module_param(yaffs_bg_idle_ms, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
@@ -509,7 +525,11 @@ static  int yaffs_vfs_setsize(struct inode *inode, loff_t newsize)
 
 static unsigned yaffs_gc_control_callback(yaffs_Device *dev)
 {
-	return yaffs_gc_control;
+	unsigned control = yaffs_gc_control;
+
+	if(yaffs_DeviceToLC(dev)->bgThread && yaffs_bg_enable)
+		control |= 2;
+	return control;
 }
                 	                                                                                          	
 static void yaffs_GrossLock(yaffs_Device *dev)
@@ -2240,11 +2260,12 @@ static void yaffs_FlushSuperBlock(struct super_block *sb, int do_checkpoint)
 }
 
 
-static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
+static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev, int idle)
 {
 	unsigned erasedChunks = dev->nErasedBlocks * dev->param.nChunksPerBlock;
 	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
 	unsigned scatteredFree = 0; /* Free chunks not in an erased block */
+	unsigned erasedPct;
 
 	if(erasedChunks < dev->nFreeChunks)
 		scatteredFree = (dev->nFreeChunks - erasedChunks);
@@ -2253,9 +2274,13 @@ static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
 		return 0;
 	else if(scatteredFree < (dev->param.nChunksPerBlock * 2))
 		return 0;
-	else if(erasedChunks > dev->nFreeChunks/2)
-		return 0;
-	else if(erasedChunks > dev->nFreeChunks/4)
+
+	erasedPct = dev->nFreeChunks > 0 ?
+			erasedChunks * 100 / dev->nFreeChunks : 100;
+
+	if(erasedPct > yaffs_bg_gc_soft)
+		return (idle && erasedPct < yaffs_bg_gc_idle) ? 1 : 0;
+	else if(erasedPct > yaffs_bg_gc_hard)
 		return 1;
 	else
 		return 2;
@@ -2267,7 +2292,7 @@ static int yaffs_do_sync_fs(struct super_block *sb,
 
 	yaffs_Device *dev = yaffs_SuperToDevice(sb);
 	unsigned int oneshot_checkpoint = (yaffs_auto_checkpoint & 4);
-	unsigned gc_urgent = yaffs_bg_gc_urgency(dev);
+	unsigned gc_urgent = yaffs_bg_gc_urgency(dev, 0);
 	int do_checkpoint;
 
 	T(YAFFS_TRACE_OS | YAFFS_TRACE_SYNC | YAFFS_TRACE_BACKGROUND,
@@ -2312,6 +2337,17 @@ void yaffs_background_waker(unsigned long data)
 	wake_up_process((struct task_struct *)data);
 }
 
+/* Called by a writer, under the gross lock, instead of doing passive gc */
+static void yaffs_WakeBackgroundGC(yaffs_Device *dev)
+{
+	struct yaffs_LinuxContext *context = yaffs_DeviceToLC(dev);
+
+	if(context->bgThread && !context->bgGCWanted){
+		context->bgGCWanted = 1;
+		wake_up_process(context->bgThread);
+	}
+}
+
 static int yaffs_BackgroundThread(void *data)
 {
 	yaffs_Device *dev = (yaffs_Device *)data;
@@ -2319,8 +2355,12 @@ static int yaffs_BackgroundThread(void *data)
 	unsigned long now = jiffies;
 	unsigned long next_dir_update = now;
 	unsigned long next_gc = now;
+	unsigned long last_write = now;
 	unsigned long expires;
+	unsigned long idle_jiffies;
 	unsigned int urgency;
+	__u32 pageWrites = 0;
+	int idle;
 
 	int gcResult;
 	struct timer_list timer;
@@ -2347,19 +2387,35 @@ static int yaffs_BackgroundThread(void *data)
 
 		now = jiffies;
 
+		/* Idle means no page writes other than our own for a while */
+		if(dev->nPageWrites != pageWrites){
+			pageWrites = dev->nPageWrites;
+			last_write = now;
+		}
+		idle_jiffies = msecs_to_jiffies(yaffs_bg_idle_ms);
+		idle = time_after_eq(now, last_write + idle_jiffies);
+
 		if(time_after(now, next_dir_update) && yaffs_bg_enable){
 			yaffs_UpdateDirtyDirectories(dev);
 			next_dir_update = now + HZ;
 		}
 
-		if(time_after(now,next_gc) && yaffs_bg_enable){
+		if((time_after(now,next_gc) || context->bgGCWanted) &&
+			yaffs_bg_enable){
+			int wanted = context->bgGCWanted;
+
+			context->bgGCWanted = 0;
 			if(!dev->isCheckpointed){
-				urgency = yaffs_bg_gc_urgency(dev);
+				/* A writer waiting on us gets the idle quota */
+				urgency = yaffs_bg_gc_urgency(dev, idle || wanted);
 				gcResult = yaffs_BackgroundGarbageCollect(dev, urgency);
 				if(urgency > 1)
 					next_gc = now + HZ/20+1;
 				else if(urgency > 0)
 					next_gc = now + HZ/10+1;
+				else if(!idle)
+					/* Look again once the device has gone idle */
+					next_gc = last_write + idle_jiffies + 1;
 				else
 					next_gc = now + HZ * 2;
 			} else /*
@@ -2367,6 +2423,7 @@ static int yaffs_BackgroundThread(void *data)
 				* to cut down on wake ups
 				*/
 				next_gc = next_dir_update;
+			pageWrites = dev->nPageWrites;
 		}
 		yaffs_GrossUnlock(dev);
 #if 1
@@ -2383,7 +2440,9 @@ static int yaffs_BackgroundThread(void *data)
 
                 set_current_state(TASK_INTERRUPTIBLE);
 		add_timer(&timer);
-		schedule();
+		if(!context->bgGCWanted)
+			schedule();
+		__set_current_state(TASK_RUNNING);
 		del_timer_sync(&timer);
 #else
 		msleep(10);
@@ -2606,6 +2665,7 @@ typedef struct {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int cache_size;
 	int tags_ecc_on;
 	int tags_ecc_overridden;
 	int lazy_loading_enabled;
@@ -2660,6 +2720,9 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 			options->empty_lost_and_found_overridden=1;
 		} else if (!strcmp(cur_opt, "no-cache"))
 			options->no_cache = 1;
+		else if (!strncmp(cur_opt, "cache-size=", 11))
+			options->cache_size =
+				simple_strtol(cur_opt + 11, NULL, 0);
 		else if (!strcmp(cur_opt, "no-checkpoint-read"))
 			options->skip_checkpoint_read = 1;
 		else if (!strcmp(cur_opt, "no-checkpoint-write"))
@@ -2697,6 +2760,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	yaffs_options options;
 
 	unsigned mount_id;
+	unsigned long mountStart;
 	int found;
 	struct yaffs_LinuxContext *context_iterator;
 	struct ylist_head *l;
@@ -2916,7 +2980,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	param->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	param->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	param->nReservedBlocks = 5;
-	param->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	param->nShortOpCaches = (options.no_cache) ? 0 :
+				(options.cache_size > 0) ? options.cache_size : 10;
 	param->inbandTags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2965,6 +3030,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_ReadChunkWithTagsFromNAND;
 		param->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		param->queryNANDBlock = nandmtd2_QueryNANDBlock;
+		param->readBlockTagsFromNAND = nandmtd2_ReadBlockTagsFromNAND;
+		param->nScanThreads = yaffs_scan_threads;
 		yaffs_DeviceToLC(dev)->spareBuffer = YMALLOC(mtd->oobsize);
 		param->isYaffs2 = 1;
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
@@ -3001,6 +3068,9 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 
 	param->markSuperBlockDirty = yaffs_MarkSuperBlockDirty;
 	param->gcControl = yaffs_gc_control_callback;
+#ifdef YAFFS_COMPILE_BACKGROUND
+	param->wakeBackgroundGC = yaffs_WakeBackgroundGC;
+#endif
 
 	yaffs_DeviceToLC(dev)->superBlock= sb;
 	
@@ -3040,7 +3110,10 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 
 	yaffs_GrossLock(dev);
 
+	mountStart = jiffies;
 	err = yaffs_GutsInitialise(dev);
+	context->mountTime = jiffies_to_msecs(jiffies - mountStart);
+	context->mountFromCheckpoint = dev->isCheckpointed;
 
 	T(YAFFS_TRACE_OS,
 	  (TSTR("yaffs_read_super: guts initialised %s\n"),
@@ -3198,6 +3271,7 @@ static char *yaffs_dump_dev_part0(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "disableLazyLoad.... %d\n", dev->param.disableLazyLoad);
 	buf += sprintf(buf, "refreshPeriod...... %d\n", dev->param.refreshPeriod);
 	buf += sprintf(buf, "nShortOpCaches..... %d\n", dev->param.nShortOpCaches);
+	buf += sprintf(buf, "nScanThreads....... %d\n", dev->param.nScanThreads);
 	buf += sprintf(buf, "nReservedBlocks.... %d\n", dev->param.nReservedBlocks);
 	buf += sprintf(buf, "alwaysCheckErased.. %d\n", dev->param.alwaysCheckErased);
 
@@ -3228,6 +3302,15 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "oldestDirtyGCs..... %u\n", dev->oldestDirtyGCs);
 	buf += sprintf(buf, "nGCBlocks.......... %u\n", dev->nGCBlocks);
 	buf += sprintf(buf, "backgroundGCs...... %u\n", dev->backgroundGCs);
+	buf += sprintf(buf, "fgGCCalls.......... %u\n", dev->fgGCCalls);
+	buf += sprintf(buf, "fgGCDeferred....... %u\n", dev->fgGCDeferred);
+	buf += sprintf(buf, "fgGCTime........... %llu us\n",
+			(unsigned long long)dev->fgGCTime);
+	buf += sprintf(buf, "fgGCMaxTime........ %u us\n", dev->fgGCMaxTime);
+	buf += sprintf(buf, "bgGCCalls.......... %u\n", dev->bgGCCalls);
+	buf += sprintf(buf, "bgGCTime........... %llu us\n",
+			(unsigned long long)dev->bgGCTime);
+	buf += sprintf(buf, "bgGCMaxTime........ %u us\n", dev->bgGCMaxTime);
 	buf += sprintf(buf, "nRetriedWrites..... %u\n", dev->nRetriedWrites);
 	buf += sprintf(buf, "nRetireBlocks...... %u\n", dev->nRetiredBlocks);
 	buf += sprintf(buf, "eccFixed........... %u\n", dev->eccFixed);
@@ -3235,6 +3318,12 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %u\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %u\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %u\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %u\n", dev->cacheMisses);
+	buf += sprintf(buf, "checkpointGen...... %u\n", dev->checkpointGeneration);
+	buf += sprintf(buf, "mountTime.......... %u ms\n",
+			yaffs_DeviceToLC(dev)->mountTime);
+	buf += sprintf(buf, "mountFromCheckpoint %d\n",
+			yaffs_DeviceToLC(dev)->mountFromCheckpoint);
 	buf += sprintf(buf, "nDeletedFiles...... %u\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %u\n", dev->nUnlinkedFiles);
 	buf += sprintf(buf, "refreshCount....... %u\n", dev->refreshCount);
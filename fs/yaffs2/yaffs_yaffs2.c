@@ -292,6 +292,7 @@ static void yaffs2_DeviceToCheckpointDevice(yaffs_CheckpointDevice *cp,
 	cp->nUnlinkedFiles = dev->nUnlinkedFiles;
 	cp->nBackgroundDeletions = dev->nBackgroundDeletions;
 	cp->sequenceNumber = dev->sequenceNumber;
+	cp->checkpointGeneration = dev->checkpointGeneration + 1;
 
 }
 
@@ -307,6 +308,7 @@ static void yaffs2_CheckpointDeviceToDevice(yaffs_Device *dev,
 	dev->nUnlinkedFiles = cp->nUnlinkedFiles;
 	dev->nBackgroundDeletions = cp->nBackgroundDeletions;
 	dev->sequenceNumber = cp->sequenceNumber;
+	dev->checkpointGeneration = cp->checkpointGeneration;
 }
 
 
@@ -699,9 +701,10 @@ static int yaffs2_WriteCheckpointData(yaffs_Device *dev)
 	if (!yaffs2_CheckpointClose(dev))
 		ok = 0;
 
-	if (ok)
+	if (ok) {
 		dev->isCheckpointed = 1;
-	else
+		dev->checkpointGeneration++;
+	} else
 		dev->isCheckpointed = 0;
 
 	return dev->isCheckpointed;
@@ -909,6 +912,106 @@ static int yaffs2_ybicmp(const void *a, const void *b)
 		return aseq - bseq;
 }
 
+/*
+ * Read-ahead of tags for the backwards scan. The tags of the next
+ * YAFFS2_SCAN_BATCH blocks to scan are read at once through
+ * dev->param.readBlockTagsFromNAND, which may use several threads. The
+ * scan itself still consumes them one chunk at a time in the same order.
+ */
+#define YAFFS2_SCAN_BATCH	16
+
+typedef struct {
+	yaffs_ExtendedTags *tags;
+	__u8 *mtdEcc;
+	int blocks[YAFFS2_SCAN_BATCH];
+	int nBlocks;
+} yaffs2_ScanAhead;
+
+static void yaffs2_ScanAheadDeinit(yaffs2_ScanAhead *sa)
+{
+	if (sa->tags)
+		YFREE_ALT(sa->tags);
+	if (sa->mtdEcc)
+		YFREE_ALT(sa->mtdEcc);
+	sa->tags = NULL;
+	sa->mtdEcc = NULL;
+}
+
+static void yaffs2_ScanAheadInit(yaffs_Device *dev, yaffs2_ScanAhead *sa)
+{
+	int nChunks = YAFFS2_SCAN_BATCH * dev->param.nChunksPerBlock;
+
+	sa->nBlocks = 0;
+	sa->tags = NULL;
+	sa->mtdEcc = NULL;
+
+	if (!dev->param.readBlockTagsFromNAND ||
+	    dev->param.nScanThreads < 2 || dev->param.inbandTags)
+		return;
+
+	sa->tags = YMALLOC_ALT(nChunks * sizeof(yaffs_ExtendedTags));
+	sa->mtdEcc = YMALLOC_ALT(nChunks);
+	if (!sa->tags || !sa->mtdEcc)
+		yaffs2_ScanAheadDeinit(sa);
+}
+
+/* Make sure the tags of blockIndex[iter] are read, reading ahead towards
+ * blockIndex[startIterator].
+ */
+static void yaffs2_ScanAheadFill(yaffs_Device *dev, yaffs2_ScanAhead *sa,
+				yaffs_BlockIndex *blockIndex, int iter,
+				int startIterator)
+{
+	int i;
+
+	if (!sa->tags)
+		return;
+	for (i = 0; i < sa->nBlocks; i++) {
+		if (sa->blocks[i] == blockIndex[iter].block)
+			return;
+	}
+
+	for (sa->nBlocks = 0;
+	     sa->nBlocks < YAFFS2_SCAN_BATCH && iter >= startIterator; iter--)
+		sa->blocks[sa->nBlocks++] = blockIndex[iter].block;
+
+	if (dev->param.readBlockTagsFromNAND(dev, sa->blocks, sa->nBlocks,
+					     sa->tags, sa->mtdEcc) != YAFFS_OK)
+		sa->nBlocks = 0;
+}
+
+/* Get the tags of a chunk, from the read-ahead if it has them. */
+static void yaffs2_ScanReadTags(yaffs_Device *dev, yaffs2_ScanAhead *sa,
+				int blk, int c, yaffs_ExtendedTags *tags)
+{
+	int i;
+
+	for (i = 0; i < sa->nBlocks; i++) {
+		if (sa->blocks[i] != blk)
+			continue;
+
+		*tags = sa->tags[i * dev->param.nChunksPerBlock + c];
+		dev->nPageReads++;
+		/* Counted like nandmtd2_ReadChunkWithTagsFromNAND() does */
+		switch (sa->mtdEcc[i * dev->param.nChunksPerBlock + c]) {
+		case YAFFS_ECC_RESULT_FIXED:
+			dev->eccFixed++;
+			break;
+		case YAFFS_ECC_RESULT_UNFIXED:
+			dev->eccUnfixed++;
+			break;
+		default:
+			break;
+		}
+		if (tags->eccResult > YAFFS_ECC_RESULT_NO_ERROR)
+			yaffs_HandleChunkError(dev, yaffs_GetBlockInfo(dev, blk));
+		return;
+	}
+
+	yaffs_ReadChunkWithTagsFromNAND(dev,
+			blk * dev->param.nChunksPerBlock + c, NULL, tags);
+}
+
 int yaffs2_ScanBackwards(yaffs_Device *dev)
 {
 	yaffs_ExtendedTags tags;
@@ -942,6 +1045,7 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 
 	yaffs_BlockIndex *blockIndex = NULL;
 	int altBlockIndex = 0;
+	yaffs2_ScanAhead scanAhead;
 
 	T(YAFFS_TRACE_SCAN,
 	  (TSTR
@@ -950,6 +1054,7 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 
 
 	dev->sequenceNumber = YAFFS_LOWEST_SEQUENCE_NUMBER;
+	dev->checkpointGeneration = 0;
 
 	blockIndex = YMALLOC(nBlocks * sizeof(yaffs_BlockIndex));
 
@@ -1046,6 +1151,8 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 	T(YAFFS_TRACE_SCAN_DEBUG,
 	  (TSTR("%d blocks to be scanned" TENDSTR), nBlocksToScan));
 
+	yaffs2_ScanAheadInit(dev, &scanAhead);
+
 	/* For each block.... backwards */
 	for (blockIterator = endIterator; !alloc_failed && blockIterator >= startIterator;
 			blockIterator--) {
@@ -1056,6 +1163,9 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 		/* get the block to scan in the correct order */
 		blk = blockIndex[blockIterator].block;
 
+		yaffs2_ScanAheadFill(dev, &scanAhead, blockIndex,
+				     blockIterator, startIterator);
+
 		bi = yaffs_GetBlockInfo(dev, blk);
 
 
@@ -1075,8 +1185,7 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->param.nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			yaffs2_ScanReadTags(dev, &scanAhead, blk, c, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -1516,6 +1625,8 @@ int yaffs2_ScanBackwards(yaffs_Device *dev)
 	
 	yaffs_SkipRestOfBlock(dev);
 
+	yaffs2_ScanAheadDeinit(&scanAhead);
+
 	if (altBlockIndex)
 		YFREE_ALT(blockIndex);
 	else
@@ -49,6 +49,7 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/xattr.h>
+#include <linux/ktime.h>
 
 #define YCHAR char
 #define YUCHAR unsigned char
@@ -87,6 +88,9 @@
 #define Y_TIME_CONVERT(x) (x)
 #endif
 
+/* Free running microsecond clock, only used for statistics */
+#define Y_TIME_US() ((__u32)ktime_to_us(ktime_get()))
+
 #define yaffs_SumCompare(x, y) ((x) == (y))
 #define yaffs_strcmp(a, b) strcmp(a, b)
 
@@ -316,6 +320,10 @@
 
 #endif
 
+#ifndef Y_TIME_US
+#define Y_TIME_US() 0
+#endif
+
 #ifndef Y_DUMP_STACK
 #define Y_DUMP_STACK() do { } while (0)
 #endif
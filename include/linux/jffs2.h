@@ -67,6 +67,8 @@
 #define JFFS2_NODETYPE_XATTR (JFFS2_FEATURE_INCOMPAT | JFFS2_NODE_ACCURATE | 8)
 #define JFFS2_NODETYPE_XREF (JFFS2_FEATURE_INCOMPAT | JFFS2_NODE_ACCURATE | 9)
 
+#define JFFS2_NODETYPE_INODE_INDEX (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 10)
+
 /* XATTR Related */
 #define JFFS2_XPREFIX_USER		1	/* for "user." */
 #define JFFS2_XPREFIX_SECURITY		2	/* for "security." */
@@ -189,6 +191,45 @@ struct jffs2_raw_xref
 	jint32_t node_crc;
 } __attribute__((packed));
 
+/* One fragment of the file described by an inode index node. Holes have
+   node == JFFS2_INDEX_HOLE. */
+#define JFFS2_INDEX_HOLE 0xffffffff
+
+struct jffs2_index_frag
+{
+	jint32_t node;		/* Flash offset of the data node */
+	jint32_t version;	/* ... and its version */
+	jint32_t ofs;		/* Range of the file covered by this fragment */
+	jint32_t size;
+	jint32_t node_ofs;	/* Range of the file covered by the whole node */
+	jint32_t node_size;
+} __attribute__((packed));
+
+/* Fragment map and attributes of a regular file as of the node version
+   'version', so that read_inode() doesn't have to read every node */
+struct jffs2_raw_inode_index
+{
+	jint16_t magic;
+	jint16_t nodetype;	/* = JFFS2_NODETYPE_INODE_INDEX */
+	jint32_t totlen;
+	jint32_t hdr_crc;
+	jint32_t ino;		/* inode number */
+	jint32_t version;	/* highest node version of the inode */
+	jmode_t mode;
+	jint16_t uid;
+	jint16_t gid;
+	jint32_t isize;
+	jint32_t atime;
+	jint32_t mtime;
+	jint32_t ctime;
+	jint32_t metadata;	/* Flash offset of the metadata node, or JFFS2_INDEX_HOLE */
+	jint32_t metadata_version;
+	jint32_t nr_frags;
+	jint32_t data_crc;	/* CRC for the fragment list */
+	jint32_t node_crc;	/* CRC for the header (excluding the CRCs) */
+	struct jffs2_index_frag frags[0];
+} __attribute__((packed));
+
 struct jffs2_raw_summary
 {
 	jint16_t magic;
@@ -210,6 +251,7 @@ union jffs2_node_union
 	struct jffs2_raw_xattr x;
 	struct jffs2_raw_xref r;
 	struct jffs2_raw_summary s;
+	struct jffs2_raw_inode_index ii;
 	struct jffs2_unknown_node u;
 };
 
@@ -32,6 +32,18 @@ extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask,
 extern int register_oom_notifier(struct notifier_block *nb);
 extern int unregister_oom_notifier(struct notifier_block *nb);
 
+struct signal_struct;
+
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_index_add(struct signal_struct *sig);
+extern void lowmem_index_del(struct signal_struct *sig);
+extern void lowmem_index_update(struct signal_struct *sig);
+#else
+static inline void lowmem_index_add(struct signal_struct *sig) { }
+static inline void lowmem_index_del(struct signal_struct *sig) { }
+static inline void lowmem_index_update(struct signal_struct *sig) { }
+#endif
+
 extern bool oom_killer_disabled;
 
 static inline void oom_killer_disable(void)
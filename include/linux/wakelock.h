@@ -18,6 +18,8 @@
 
 #include <linux/list.h>
 #include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
 
 /* A wake_lock prevents the system from entering suspend or other low power
  * states when active. If the type is set to WAKE_LOCK_SUSPEND, the wake_lock
@@ -35,9 +37,11 @@ enum {
 struct wake_lock {
 #ifdef CONFIG_HAS_WAKELOCK
 	struct list_head    link;
+	spinlock_t          state_lock; /* protects flags, expires and stat */
 	int                 flags;
 	const char         *name;
 	unsigned long       expires;
+	struct timer_list   expire_timer;
 #ifdef CONFIG_WAKELOCK_STAT
 	struct {
 		int             count;
@@ -45,8 +49,15 @@ struct wake_lock {
 		int             wakeup_count;
 		ktime_t         total_time;
 		ktime_t         prevent_suspend_time;
+		ktime_t         prevent_suspend_start;
 		ktime_t         max_time;
 		ktime_t         last_time;
+		pid_t           last_pid;
+		/* suspend aborts and snapshots for the current window */
+		int             abort_count;
+		int             window_count;
+		ktime_t         window_total_time;
+		ktime_t         window_prevent_time;
 	} stat;
 #endif
 #endif
@@ -68,8 +79,8 @@ int wake_lock_active(struct wake_lock *lock);
 
 /* has_wake_lock returns 0 if no wake locks of the specified type are active,
  * and non-zero if one or more wake locks are held. Specifically it returns
- * -1 if one or more wake locks with no timeout are active or the
- * number of jiffies until all active wake locks time out.
+ * -1 if one or more wake locks with no timeout are active or an upper bound
+ * of the number of jiffies until all active wake locks time out.
  */
 long has_wake_lock(int type);
 
@@ -0,0 +1,83 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM wakelock
+
+#if !defined(_TRACE_WAKELOCK_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_WAKELOCK_H
+
+#include <linux/wakelock.h>
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(wake_lock,
+
+	TP_PROTO(struct wake_lock *lock, int type, long timeout),
+
+	TP_ARGS(lock, type, timeout),
+
+	TP_STRUCT__entry(
+		__string(	name,		lock->name	)
+		__field(	int,		type		)
+		__field(	long,		timeout		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, lock->name);
+		__entry->type = type;
+		__entry->timeout = timeout;
+	),
+
+	TP_printk("name=%s type=%d timeout=%ld", __get_str(name),
+		  __entry->type, __entry->timeout)
+);
+
+DECLARE_EVENT_CLASS(wake_lock_release,
+
+	TP_PROTO(struct wake_lock *lock),
+
+	TP_ARGS(lock),
+
+	TP_STRUCT__entry(
+		__string(	name,		lock->name	)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, lock->name);
+	),
+
+	TP_printk("name=%s", __get_str(name))
+);
+
+DEFINE_EVENT(wake_lock_release, wake_unlock,
+
+	TP_PROTO(struct wake_lock *lock),
+
+	TP_ARGS(lock)
+);
+
+DEFINE_EVENT(wake_lock_release, wake_lock_expire,
+
+	TP_PROTO(struct wake_lock *lock),
+
+	TP_ARGS(lock)
+);
+
+TRACE_EVENT(suspend_abort,
+
+	TP_PROTO(const char *name),
+
+	TP_ARGS(name),
+
+	TP_STRUCT__entry(
+		__string(	name,		name		)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+	),
+
+	TP_printk("blocked_by=%s", __get_str(name))
+);
+
+#endif /* _TRACE_WAKELOCK_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -50,6 +50,7 @@
 #include <linux/perf_event.h>
 #include <trace/events/sched.h>
 #include <linux/hw_breakpoint.h>
+#include <linux/oom.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -127,6 +128,8 @@ static void __exit_signal(struct task_struct *tsk)
 	}
 
 	sig->nr_threads--;
+	if (group_dead)
+		lowmem_index_del(sig);
 	__unhash_process(tsk, group_dead);
 
 	/*
@@ -13,10 +13,13 @@
  *
  */
 
+#include <linux/async.h>
 #include <linux/earlysuspend.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/proc_fs.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -30,6 +33,14 @@ enum {
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/*
+ * Run the handlers of one level concurrently. Off by default: handlers
+ * used to run in registration order within a level, and some may still
+ * rely on that.
+ */
+static int parallel;
+module_param_named(parallel, parallel, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
 static void early_suspend(struct work_struct *work);
@@ -43,6 +54,51 @@ enum {
 	SUSPEND_REQUESTED_AND_SUSPENDED = SUSPEND_REQUESTED | SUSPENDED,
 };
 static int state;
+static LIST_HEAD(early_suspend_domain);
+static ktime_t early_suspend_time;
+static ktime_t late_resume_time;
+
+static void call_suspend(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	h->suspend(h);
+	h->suspend_time = ktime_sub(ktime_get(), start);
+	if (h->suspend_time.tv64 > h->suspend_max.tv64)
+		h->suspend_max = h->suspend_time;
+}
+
+static void call_resume(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	h->resume(h);
+	h->resume_time = ktime_sub(ktime_get(), start);
+	if (h->resume_time.tv64 > h->resume_max.tv64)
+		h->resume_max = h->resume_time;
+}
+
+/*
+ * Starts a handler, after waiting for all handlers of the previous level
+ * when the level changes. Handlers of the same level run concurrently from
+ * the async threads, so the latency of a level is that of its slowest
+ * handler instead of the sum. Caller must hold early_suspend_lock and call
+ * async_synchronize_full_domain() when done.
+ */
+static void call_handler(async_func_ptr *fn, struct early_suspend *h,
+			 int *level)
+{
+	if (h->level != *level) {
+		async_synchronize_full_domain(&early_suspend_domain);
+		*level = h->level;
+	}
+	if (parallel)
+		async_schedule_domain(fn, h, &early_suspend_domain);
+	else
+		fn(h, 0);
+}
 
 void register_early_suspend(struct early_suspend *handler)
 {
@@ -57,7 +113,7 @@ void register_early_suspend(struct early_suspend *handler)
 	}
 	list_add_tail(&handler->link, pos);
 	if ((state & SUSPENDED) && handler->suspend)
-		handler->suspend(handler);
+		call_suspend(handler, 0);
 	mutex_unlock(&early_suspend_lock);
 }
 EXPORT_SYMBOL(register_early_suspend);
@@ -75,6 +131,8 @@ static void early_suspend(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -93,10 +151,17 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
+	start = ktime_get();
+	level = INT_MIN;
 	list_for_each_entry(pos, &early_suspend_handlers, link) {
 		if (pos->suspend != NULL)
-			pos->suspend(pos);
+			call_handler(call_suspend, pos, &level);
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	early_suspend_time = ktime_sub(ktime_get(), start);
+	if (debug_mask & DEBUG_SUSPEND)
+		pr_info("early_suspend: handlers took %lld ns\n",
+			ktime_to_ns(early_suspend_time));
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -115,6 +180,8 @@ static void late_resume(struct work_struct *work)
 	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
+	int level;
+	ktime_t start;
 
 	mutex_lock(&early_suspend_lock);
 	spin_lock_irqsave(&state_lock, irqflags);
@@ -131,11 +198,16 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
+	start = ktime_get();
+	level = INT_MIN;
 	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
 		if (pos->resume != NULL)
-			pos->resume(pos);
+			call_handler(call_resume, pos, &level);
+	async_synchronize_full_domain(&early_suspend_domain);
+	late_resume_time = ktime_sub(ktime_get(), start);
 	if (debug_mask & DEBUG_SUSPEND)
-		pr_info("late_resume: done\n");
+		pr_info("late_resume: done in %lld ns\n",
+			ktime_to_ns(late_resume_time));
 abort:
 	mutex_unlock(&early_suspend_lock);
 }
@@ -176,3 +248,46 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+static int early_suspend_stats_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(m, "early_suspend\t%lld\tlate_resume\t%lld\n",
+		   ktime_to_ns(early_suspend_time),
+		   ktime_to_ns(late_resume_time));
+	seq_puts(m, "level\thandler\tsuspend_time\tmax_suspend_time"
+		 "\tresume_time\tmax_resume_time\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(m, "%d\t%pf\t%lld\t%lld\t%lld\t%lld\n", pos->level,
+			   pos->suspend ? (void *)pos->suspend :
+					  (void *)pos->resume,
+			   ktime_to_ns(pos->suspend_time),
+			   ktime_to_ns(pos->suspend_max),
+			   ktime_to_ns(pos->resume_time),
+			   ktime_to_ns(pos->resume_max));
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = early_suspend_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init early_suspend_stats_init(void)
+{
+	proc_create("early_suspend", S_IRUGO, NULL, &early_suspend_stats_fops);
+	return 0;
+}
+
+late_initcall(early_suspend_stats_init);
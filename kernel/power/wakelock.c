@@ -24,6 +24,9 @@
 #endif
 #include "power.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/wakelock.h>
+
 enum {
 	DEBUG_EXIT_SUSPEND = 1U << 0,
 	DEBUG_WAKEUP = 1U << 1,
@@ -40,10 +43,19 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define WAKE_LOCK_AUTO_EXPIRE            (1U << 10)
 #define WAKE_LOCK_PREVENTING_SUSPEND     (1U << 11)
 
+/*
+ * list_lock only protects the list of all wake locks. The state of each
+ * lock is protected by its own state_lock, and the number of active locks
+ * of each type is kept in atomic counters, so that wake_lock() and
+ * wake_unlock() of unrelated locks never contend and has_wake_lock() does
+ * not have to walk any list. Each lock with a timeout has its own timer.
+ */
 static DEFINE_SPINLOCK(list_lock);
-static LIST_HEAD(inactive_locks);
-static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
-static int current_event_num;
+static LIST_HEAD(all_wake_locks);
+static atomic_t active_count[WAKE_LOCK_TYPE_COUNT];
+static atomic_t untimed_count[WAKE_LOCK_TYPE_COUNT]; /* active, no timeout */
+static unsigned long max_expires[WAKE_LOCK_TYPE_COUNT];
+static atomic_t current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
 suspend_state_t requested_suspend_state = PM_SUSPEND_MEM;
@@ -51,9 +63,70 @@ static struct wake_lock unknown_wakeup;
 
 #ifdef CONFIG_WAKELOCK_STAT
 static struct wake_lock deleted_wake_locks;
-static ktime_t last_sleep_time_update;
 static int wait_for_wakeup;
 
+/*
+ * Recent lock, unlock, expire and suspend abort events, kept in a small
+ * ring that is shown by /proc/wakelock_events. Writers claim a slot with
+ * an atomic counter and store its sequence number last, so logging takes
+ * no lock; readers skip slots that are being rewritten.
+ */
+enum {
+	WAKE_EVENT_LOCK,
+	WAKE_EVENT_UNLOCK,
+	WAKE_EVENT_EXPIRE,
+	WAKE_EVENT_SUSPEND_ABORT,
+};
+static const char * const wake_event_names[] = {
+	[WAKE_EVENT_LOCK] = "lock",
+	[WAKE_EVENT_UNLOCK] = "unlock",
+	[WAKE_EVENT_EXPIRE] = "expire",
+	[WAKE_EVENT_SUSPEND_ABORT] = "suspend_abort",
+};
+static int event_log_mask = (1U << WAKE_EVENT_LOCK) |
+	(1U << WAKE_EVENT_UNLOCK) | (1U << WAKE_EVENT_EXPIRE) |
+	(1U << WAKE_EVENT_SUSPEND_ABORT);
+module_param_named(event_log_mask, event_log_mask, int,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
+
+#define WAKE_EVENT_LOG_SIZE	256	/* power of 2 */
+struct wake_lock_event {
+	unsigned int	seq;
+	int		event;
+	pid_t		pid;
+	long		timeout;
+	ktime_t		time;
+	char		name[32];
+};
+static struct wake_lock_event event_log[WAKE_EVENT_LOG_SIZE];
+static atomic_t event_log_seq;
+
+/* Per window summaries for /proc/wakelock_window, under list_lock */
+static ktime_t window_start;
+static atomic_t window_suspend_attempts;
+static int window_suspend_aborts;
+
+static void log_wake_event(int event, const char *name, pid_t pid,
+			   long timeout)
+{
+	struct wake_lock_event *e;
+	unsigned int seq;
+
+	if (!(event_log_mask & (1U << event)))
+		return;
+	seq = atomic_inc_return(&event_log_seq);
+	e = &event_log[seq & (WAKE_EVENT_LOG_SIZE - 1)];
+	e->seq = 0;
+	smp_wmb();
+	e->event = event;
+	e->pid = pid;
+	e->timeout = timeout;
+	e->time = ktime_get();
+	strlcpy(e->name, name, sizeof(e->name));
+	smp_wmb();
+	e->seq = seq;
+}
+
 int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 {
 	struct timespec ts;
@@ -81,6 +154,7 @@ int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 }
 
 
+/* Caller must hold lock->state_lock */
 static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 {
 	int lock_count = lock->stat.count;
@@ -104,7 +178,7 @@ static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 		total_time = ktime_add(total_time, add_time);
 		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
 			prevent_suspend_time = ktime_add(prevent_suspend_time,
-					ktime_sub(now, last_sleep_time_update));
+				ktime_sub(now, lock->stat.prevent_suspend_start));
 		if (add_time.tv64 > max_time.tv64)
 			max_time = add_time;
 	}
@@ -123,22 +197,129 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 	unsigned long irqflags;
 	struct wake_lock *lock;
 	int ret;
-	int type;
 
 	spin_lock_irqsave(&list_lock, irqflags);
 
 	ret = seq_puts(m, "name\tcount\texpire_count\twake_count\tactive_since"
 			"\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
-	list_for_each_entry(lock, &inactive_locks, link)
+	list_for_each_entry(lock, &all_wake_locks, link) {
+		spin_lock(&lock->state_lock);
 		ret = print_lock_stat(m, lock);
-	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
-		list_for_each_entry(lock, &active_wake_locks[type], link)
-			ret = print_lock_stat(m, lock);
+		spin_unlock(&lock->state_lock);
+	}
+	spin_unlock_irqrestore(&list_lock, irqflags);
+	return 0;
+}
+
+/* Caller must hold lock->state_lock */
+static void get_lock_totals(struct wake_lock *lock, int *count,
+			    ktime_t *total_time, ktime_t *prevent_suspend_time)
+{
+	*count = lock->stat.count;
+	*total_time = lock->stat.total_time;
+	*prevent_suspend_time = lock->stat.prevent_suspend_time;
+	if (lock->flags & WAKE_LOCK_ACTIVE) {
+		ktime_t now;
+		if (!get_expired_time(lock, &now))
+			now = ktime_get();
+		(*count)++;
+		*total_time = ktime_add(*total_time,
+					ktime_sub(now, lock->stat.last_time));
+		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
+			*prevent_suspend_time = ktime_add(*prevent_suspend_time,
+				ktime_sub(now, lock->stat.prevent_suspend_start));
+	}
+}
+
+/*
+ * Shows what each lock did since the window was last restarted by a write
+ * to /proc/wakelock_window: how often it was taken, how long it was held,
+ * how long it kept the system from suspending and how many suspend
+ * attempts it aborted.
+ */
+static int wakelock_window_show(struct seq_file *m, void *unused)
+{
+	unsigned long irqflags;
+	struct wake_lock *lock;
+	ktime_t total_time, prevent_suspend_time;
+	int count;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	seq_printf(m, "window	%lld	suspend_attempts	%d	suspend_aborts	%d\n",
+		   ktime_to_ns(ktime_sub(ktime_get(), window_start)),
+		   atomic_read(&window_suspend_attempts),
+		   window_suspend_aborts);
+	seq_puts(m, "name	count	total_time	sleep_time	suspend_aborts\n");
+	list_for_each_entry(lock, &all_wake_locks, link) {
+		spin_lock(&lock->state_lock);
+		get_lock_totals(lock, &count, &total_time,
+				&prevent_suspend_time);
+		count -= lock->stat.window_count;
+		total_time = ktime_sub(total_time,
+				       lock->stat.window_total_time);
+		prevent_suspend_time = ktime_sub(prevent_suspend_time,
+					lock->stat.window_prevent_time);
+		if (count || lock->stat.abort_count ||
+		    ktime_to_ns(total_time))
+			seq_printf(m, "\"%s\"	%d	%lld	%lld	%d\n",
+				   lock->name, count, ktime_to_ns(total_time),
+				   ktime_to_ns(prevent_suspend_time),
+				   lock->stat.abort_count);
+		spin_unlock(&lock->state_lock);
 	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 	return 0;
 }
 
+static ssize_t wakelock_window_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	unsigned long irqflags;
+	struct wake_lock *lock;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	list_for_each_entry(lock, &all_wake_locks, link) {
+		spin_lock(&lock->state_lock);
+		get_lock_totals(lock, &lock->stat.window_count,
+				&lock->stat.window_total_time,
+				&lock->stat.window_prevent_time);
+		lock->stat.abort_count = 0;
+		spin_unlock(&lock->state_lock);
+	}
+	window_start = ktime_get();
+	atomic_set(&window_suspend_attempts, 0);
+	window_suspend_aborts = 0;
+	spin_unlock_irqrestore(&list_lock, irqflags);
+	return count;
+}
+
+static int wakelock_events_show(struct seq_file *m, void *unused)
+{
+	struct wake_lock_event e;
+	unsigned int seq, head;
+
+	head = atomic_read(&event_log_seq);
+	seq = head > WAKE_EVENT_LOG_SIZE ? head - WAKE_EVENT_LOG_SIZE + 1 : 1;
+	seq_puts(m, "time	pid	event	name	timeout\n");
+	for (; seq && seq <= head; seq++) {
+		struct wake_lock_event *slot =
+			&event_log[seq & (WAKE_EVENT_LOG_SIZE - 1)];
+
+		if (ACCESS_ONCE(slot->seq) != seq)
+			continue;
+		smp_rmb();
+		e = *slot;
+		smp_rmb();
+		if (ACCESS_ONCE(slot->seq) != seq)
+			continue;
+		e.name[sizeof(e.name) - 1] = '\0';
+		seq_printf(m, "%lld	%d	%s	\"%s\"	%ld\n",
+			   ktime_to_ns(e.time), e.pid,
+			   wake_event_names[e.event], e.name, e.timeout);
+	}
+	return 0;
+}
+
 static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 {
 	ktime_t duration;
@@ -158,61 +339,127 @@ static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 		lock->stat.max_time = duration;
 	lock->stat.last_time = ktime_get();
 	if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-		duration = ktime_sub(now, last_sleep_time_update);
+		duration = ktime_sub(now, lock->stat.prevent_suspend_start);
 		lock->stat.prevent_suspend_time = ktime_add(
 			lock->stat.prevent_suspend_time, duration);
 		lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
 	}
 }
 
-static void update_sleep_wait_stats_locked(int done)
+/*
+ * Called when main_wake_lock is taken (done) or released. While it is not
+ * held, the active suspend locks are what keeps the system from sleeping.
+ */
+static void update_sleep_wait_stats(int done)
 {
 	struct wake_lock *lock;
-	ktime_t now, etime, elapsed, add;
-	int expired;
+	unsigned long irqflags;
+	ktime_t now;
 
 	now = ktime_get();
-	elapsed = ktime_sub(now, last_sleep_time_update);
-	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND], link) {
-		expired = get_expired_time(lock, &etime);
-		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-			if (expired)
-				add = ktime_sub(etime, last_sleep_time_update);
-			else
-				add = elapsed;
+	spin_lock_irqsave(&list_lock, irqflags);
+	list_for_each_entry(lock, &all_wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != WAKE_LOCK_SUSPEND ||
+		    lock == &main_wake_lock)
+			continue;
+		spin_lock(&lock->state_lock);
+		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
 			lock->stat.prevent_suspend_time = ktime_add(
-				lock->stat.prevent_suspend_time, add);
-		}
-		if (done || expired)
-			lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
-		else
+				lock->stat.prevent_suspend_time,
+				ktime_sub(now, lock->stat.prevent_suspend_start));
+		if (!done && (lock->flags & WAKE_LOCK_ACTIVE)) {
 			lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
+			lock->stat.prevent_suspend_start = now;
+		} else
+			lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
+		spin_unlock(&lock->state_lock);
 	}
-	last_sleep_time_update = now;
+	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 #endif
 
+static void suspend(struct work_struct *work);
+static DECLARE_WORK(suspend_work, suspend);
 
-static void expire_wake_lock(struct wake_lock *lock)
+/*
+ * Marks an inactive lock active. Caller must hold lock->state_lock.
+ */
+static void activate_wake_lock_locked(struct wake_lock *lock, int type)
 {
+	lock->flags |= WAKE_LOCK_ACTIVE;
+	atomic_inc(&active_count[type]);
 #ifdef CONFIG_WAKELOCK_STAT
-	wake_unlock_stat_locked(lock, 1);
+	lock->stat.last_time = ktime_get();
+	if (type == WAKE_LOCK_SUSPEND && lock != &main_wake_lock &&
+	    !wake_lock_active(&main_wake_lock)) {
+		lock->flags |= WAKE_LOCK_PREVENTING_SUSPEND;
+		lock->stat.prevent_suspend_start = lock->stat.last_time;
+	}
 #endif
+}
+
+/*
+ * Marks an active lock inactive. Returns 1 if it was the last active lock
+ * of its type. Caller must hold lock->state_lock.
+ */
+static int deactivate_wake_lock_locked(struct wake_lock *lock, int expired)
+{
+	int type = lock->flags & WAKE_LOCK_TYPE_MASK;
+
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		return 0;
+	if (expired)
+		trace_wake_lock_expire(lock);
+#ifdef CONFIG_WAKELOCK_STAT
+	if (expired)
+		log_wake_event(WAKE_EVENT_EXPIRE, lock->name,
+			       lock->stat.last_pid, 0);
+	wake_unlock_stat_locked(lock, expired);
+#endif
+	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE))
+		atomic_dec(&untimed_count[type]);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
+	return atomic_dec_and_test(&active_count[type]);
+}
+
+static void expire_wake_lock(unsigned long data)
+{
+	struct wake_lock *lock = (struct wake_lock *)data;
+	unsigned long irqflags;
+	int last;
+
+	spin_lock_irqsave(&lock->state_lock, irqflags);
+	/* The lock may have been unlocked or relocked meanwhile */
+	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE) ||
+	    time_before(jiffies, lock->expires)) {
+		spin_unlock_irqrestore(&lock->state_lock, irqflags);
+		return;
+	}
+	last = deactivate_wake_lock_locked(lock, 1);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
+	spin_unlock_irqrestore(&lock->state_lock, irqflags);
+
+	if (last && (lock->flags & WAKE_LOCK_TYPE_MASK) == WAKE_LOCK_SUSPEND) {
+		if (debug_mask & DEBUG_EXPIRE)
+			pr_info("expire_wake_lock: %s, no wake lock left\n",
+				lock->name);
+		queue_work(suspend_work_queue, &suspend_work);
+	}
 }
 
-/* Caller must acquire the list_lock spinlock */
 static void print_active_locks(int type)
 {
 	struct wake_lock *lock;
 	bool print_expired = true;
+	unsigned long irqflags;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry(lock, &active_wake_locks[type], link) {
+	spin_lock_irqsave(&list_lock, irqflags);
+	list_for_each_entry(lock, &all_wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != type ||
+		    !(lock->flags & WAKE_LOCK_ACTIVE))
+			continue;
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
 			if (timeout > 0)
@@ -226,37 +473,67 @@ static void print_active_locks(int type)
 				print_expired = false;
 		}
 	}
+	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 
-static long has_wake_lock_locked(int type)
+long has_wake_lock(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	long ret;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	if (!atomic_read(&active_count[type]))
+		return 0;
+
+	if (atomic_read(&untimed_count[type])) {
+		ret = -1;
+	} else {
+		/* Upper bound: max_expires is not lowered on unlock */
+		ret = (long)(ACCESS_ONCE(max_expires[type]) - jiffies);
+		if (ret <= 0)
+			ret = 1;
 	}
-	return max_timeout;
+
+	if ((debug_mask & DEBUG_SUSPEND) && type == WAKE_LOCK_SUSPEND)
+		print_active_locks(type);
+	return ret;
 }
+EXPORT_SYMBOL(has_wake_lock);
 
-long has_wake_lock(int type)
+/*
+ * Attributes an aborted suspend attempt to the active suspend lock that
+ * blocked it: an untimed one if there is any, otherwise the one that
+ * expires last.
+ */
+static void suspend_blocked(void)
 {
-	long ret;
+	struct wake_lock *lock, *blocker = NULL;
 	unsigned long irqflags;
+
 	spin_lock_irqsave(&list_lock, irqflags);
-	ret = has_wake_lock_locked(type);
-	if (ret && (debug_mask & DEBUG_SUSPEND) && type == WAKE_LOCK_SUSPEND)
-		print_active_locks(type);
+	list_for_each_entry(lock, &all_wake_locks, link) {
+		if ((lock->flags & WAKE_LOCK_TYPE_MASK) != WAKE_LOCK_SUSPEND ||
+		    !(lock->flags & WAKE_LOCK_ACTIVE))
+			continue;
+		if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE)) {
+			blocker = lock;
+			break;
+		}
+		if (!blocker || time_after(lock->expires, blocker->expires))
+			blocker = lock;
+	}
+	trace_suspend_abort(blocker ? blocker->name : "none");
+#ifdef CONFIG_WAKELOCK_STAT
+	window_suspend_aborts++;
+	if (blocker) {
+		spin_lock(&blocker->state_lock);
+		blocker->stat.abort_count++;
+		log_wake_event(WAKE_EVENT_SUSPEND_ABORT, blocker->name,
+			       blocker->stat.last_pid, 0);
+		spin_unlock(&blocker->state_lock);
+	} else
+		log_wake_event(WAKE_EVENT_SUSPEND_ABORT, "none", 0, 0);
+#endif
 	spin_unlock_irqrestore(&list_lock, irqflags);
-	return ret;
 }
 
 static void suspend(struct work_struct *work)
@@ -264,13 +541,17 @@ static void suspend(struct work_struct *work)
 	int ret;
 	int entry_event_num;
 
+#ifdef CONFIG_WAKELOCK_STAT
+	atomic_inc(&window_suspend_attempts);
+#endif
 	if (has_wake_lock(WAKE_LOCK_SUSPEND)) {
 		if (debug_mask & DEBUG_SUSPEND)
 			pr_info("suspend: abort suspend\n");
+		suspend_blocked();
 		return;
 	}
 
-	entry_event_num = current_event_num;
+	entry_event_num = atomic_read(&current_event_num);
 	sys_sync();
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("suspend: enter suspend\n");
@@ -285,31 +566,12 @@ static void suspend(struct work_struct *work)
 			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
 			tm.tm_hour, tm.tm_min, tm.tm_sec, ts.tv_nsec);
 	}
-	if (current_event_num == entry_event_num) {
+	if (atomic_read(&current_event_num) == entry_event_num) {
 		if (debug_mask & DEBUG_SUSPEND)
 			pr_info("suspend: pm_suspend returned with no event\n");
 		wake_lock_timeout(&unknown_wakeup, HZ / 2);
 	}
 }
-static DECLARE_WORK(suspend_work, suspend);
-
-static void expire_wake_locks(unsigned long data)
-{
-	long has_lock;
-	unsigned long irqflags;
-	if (debug_mask & DEBUG_EXPIRE)
-		pr_info("expire_wake_locks: start\n");
-	spin_lock_irqsave(&list_lock, irqflags);
-	if (debug_mask & DEBUG_SUSPEND)
-		print_active_locks(WAKE_LOCK_SUSPEND);
-	has_lock = has_wake_lock_locked(WAKE_LOCK_SUSPEND);
-	if (debug_mask & DEBUG_EXPIRE)
-		pr_info("expire_wake_locks: done, has_lock %ld\n", has_lock);
-	if (has_lock == 0)
-		queue_work(suspend_work_queue, &suspend_work);
-	spin_unlock_irqrestore(&list_lock, irqflags);
-}
-static DEFINE_TIMER(expire_timer, expire_wake_locks, 0, 0);
 
 static int power_suspend_late(struct device *dev)
 {
@@ -317,6 +579,8 @@ static int power_suspend_late(struct device *dev)
 #ifdef CONFIG_WAKELOCK_STAT
 	wait_for_wakeup = 1;
 #endif
+	if (ret)
+		suspend_blocked();
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("power_suspend_late return %d\n", ret);
 	return ret;
@@ -350,14 +614,22 @@ void wake_lock_init(struct wake_lock *lock, int type, const char *name)
 	lock->stat.wakeup_count = 0;
 	lock->stat.total_time = ktime_set(0, 0);
 	lock->stat.prevent_suspend_time = ktime_set(0, 0);
+	lock->stat.prevent_suspend_start = ktime_set(0, 0);
 	lock->stat.max_time = ktime_set(0, 0);
 	lock->stat.last_time = ktime_set(0, 0);
+	lock->stat.last_pid = 0;
+	lock->stat.abort_count = 0;
+	lock->stat.window_count = 0;
+	lock->stat.window_total_time = ktime_set(0, 0);
+	lock->stat.window_prevent_time = ktime_set(0, 0);
 #endif
 	lock->flags = (type & WAKE_LOCK_TYPE_MASK) | WAKE_LOCK_INITIALIZED;
+	spin_lock_init(&lock->state_lock);
+	setup_timer(&lock->expire_timer, expire_wake_lock, (unsigned long)lock);
 
 	INIT_LIST_HEAD(&lock->link);
 	spin_lock_irqsave(&list_lock, irqflags);
-	list_add(&lock->link, &inactive_locks);
+	list_add(&lock->link, &all_wake_locks);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_init);
@@ -365,10 +637,16 @@ EXPORT_SYMBOL(wake_lock_init);
 void wake_lock_destroy(struct wake_lock *lock)
 {
 	unsigned long irqflags;
+	int last;
+
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
+	del_timer_sync(&lock->expire_timer);
 	spin_lock_irqsave(&list_lock, irqflags);
+	spin_lock(&lock->state_lock);
+	last = deactivate_wake_lock_locked(lock, 0);
 	lock->flags &= ~WAKE_LOCK_INITIALIZED;
+	spin_unlock(&lock->state_lock);
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
 		deleted_wake_locks.stat.count += lock->stat.count;
@@ -386,6 +664,9 @@ void wake_lock_destroy(struct wake_lock *lock)
 #endif
 	list_del(&lock->link);
 	spin_unlock_irqrestore(&list_lock, irqflags);
+
+	if (last && (lock->flags & WAKE_LOCK_TYPE_MASK) == WAKE_LOCK_SUSPEND)
+		queue_work(suspend_work_queue, &suspend_work);
 }
 EXPORT_SYMBOL(wake_lock_destroy);
 
@@ -394,74 +675,68 @@ static void wake_lock_internal(
 {
 	int type;
 	unsigned long irqflags;
-	long expire_in;
+	unsigned long expires, old;
 
-	spin_lock_irqsave(&list_lock, irqflags);
+	spin_lock_irqsave(&lock->state_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
 	BUG_ON(!(lock->flags & WAKE_LOCK_INITIALIZED));
 #ifdef CONFIG_WAKELOCK_STAT
-	if (type == WAKE_LOCK_SUSPEND && wait_for_wakeup) {
+	if (type == WAKE_LOCK_SUSPEND && wait_for_wakeup &&
+	    xchg(&wait_for_wakeup, 0)) {
 		if (debug_mask & DEBUG_WAKEUP)
 			pr_info("wakeup wake lock: %s\n", lock->name);
-		wait_for_wakeup = 0;
 		lock->stat.wakeup_count++;
 	}
-	if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) &&
-	    (long)(lock->expires - jiffies) <= 0) {
-		wake_unlock_stat_locked(lock, 0);
-		lock->stat.last_time = ktime_get();
-	}
+	lock->stat.last_pid = in_interrupt() ? 0 : current->pid;
+	log_wake_event(WAKE_EVENT_LOCK, lock->name, lock->stat.last_pid,
+		       has_timeout ? timeout : 0);
 #endif
+	trace_wake_lock(lock, type, has_timeout ? timeout : 0);
+	/* Expired, but its timer has not run yet: account the expiry now */
+	if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) &&
+	    (long)(lock->expires - jiffies) <= 0)
+		deactivate_wake_lock_locked(lock, 1);
+
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
-		lock->flags |= WAKE_LOCK_ACTIVE;
-#ifdef CONFIG_WAKELOCK_STAT
-		lock->stat.last_time = ktime_get();
-#endif
-	}
-	list_del(&lock->link);
+		activate_wake_lock_locked(lock, type);
+		if (!has_timeout)
+			atomic_inc(&untimed_count[type]);
+	} else if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE) && has_timeout)
+		atomic_dec(&untimed_count[type]);
+	else if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) && !has_timeout)
+		atomic_inc(&untimed_count[type]);
+
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
 				lock->name, type, timeout / HZ,
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
-		lock->expires = jiffies + timeout;
+		expires = jiffies + timeout;
+		lock->expires = expires;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
+		mod_timer(&lock->expire_timer, expires);
+
+		do {
+			old = ACCESS_ONCE(max_expires[type]);
+			if (!time_after(expires, old))
+				break;
+		} while (cmpxchg(&max_expires[type], old, expires) != old);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
-		list_add(&lock->link, &active_wake_locks[type]);
+		del_timer(&lock->expire_timer);
 	}
-	if (type == WAKE_LOCK_SUSPEND) {
-		current_event_num++;
+	if (type == WAKE_LOCK_SUSPEND)
+		atomic_inc(&current_event_num);
+	spin_unlock_irqrestore(&lock->state_lock, irqflags);
+
 #ifdef CONFIG_WAKELOCK_STAT
-		if (lock == &main_wake_lock)
-			update_sleep_wait_stats_locked(1);
-		else if (!wake_lock_active(&main_wake_lock))
-			update_sleep_wait_stats_locked(0);
+	if (lock == &main_wake_lock)
+		update_sleep_wait_stats(1);
 #endif
-		if (has_timeout)
-			expire_in = has_wake_lock_locked(type);
-		else
-			expire_in = -1;
-		if (expire_in > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_lock: %s, start expire timer, "
-					"%ld\n", lock->name, expire_in);
-			mod_timer(&expire_timer, jiffies + expire_in);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_lock: %s, stop expire timer\n",
-						lock->name);
-			if (expire_in == 0)
-				queue_work(suspend_work_queue, &suspend_work);
-		}
-	}
-	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 
 void wake_lock(struct wake_lock *lock)
@@ -480,40 +755,32 @@ void wake_unlock(struct wake_lock *lock)
 {
 	int type;
 	unsigned long irqflags;
-	spin_lock_irqsave(&list_lock, irqflags);
+
+	spin_lock_irqsave(&lock->state_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
-#ifdef CONFIG_WAKELOCK_STAT
-	wake_unlock_stat_locked(lock, 0);
-#endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
-	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
-	list_add(&lock->link, &inactive_locks);
+	trace_wake_unlock(lock);
+#ifdef CONFIG_WAKELOCK_STAT
+	log_wake_event(WAKE_EVENT_UNLOCK, lock->name,
+		       in_interrupt() ? 0 : current->pid, 0);
+#endif
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		del_timer(&lock->expire_timer);
+	deactivate_wake_lock_locked(lock, 0);
+	spin_unlock_irqrestore(&lock->state_lock, irqflags);
+
 	if (type == WAKE_LOCK_SUSPEND) {
-		long has_lock = has_wake_lock_locked(type);
-		if (has_lock > 0) {
-			if (debug_mask & DEBUG_EXPIRE)
-				pr_info("wake_unlock: %s, start expire timer, "
-					"%ld\n", lock->name, has_lock);
-			mod_timer(&expire_timer, jiffies + has_lock);
-		} else {
-			if (del_timer(&expire_timer))
-				if (debug_mask & DEBUG_EXPIRE)
-					pr_info("wake_unlock: %s, stop expire "
-						"timer\n", lock->name);
-			if (has_lock == 0)
-				queue_work(suspend_work_queue, &suspend_work);
-		}
+		if (!atomic_read(&active_count[type]))
+			queue_work(suspend_work_queue, &suspend_work);
 		if (lock == &main_wake_lock) {
 			if (debug_mask & DEBUG_SUSPEND)
 				print_active_locks(WAKE_LOCK_SUSPEND);
 #ifdef CONFIG_WAKELOCK_STAT
-			update_sleep_wait_stats_locked(0);
+			update_sleep_wait_stats(0);
 #endif
 		}
 	}
-	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_unlock);
 
@@ -523,6 +790,7 @@ int wake_lock_active(struct wake_lock *lock)
 }
 EXPORT_SYMBOL(wake_lock_active);
 
+#ifdef CONFIG_WAKELOCK_STAT
 static int wakelock_stats_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, wakelock_stats_show, NULL);
@@ -536,13 +804,37 @@ static const struct file_operations wakelock_stats_fops = {
 	.release = single_release,
 };
 
+static int wakelock_window_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wakelock_window_show, NULL);
+}
+
+static const struct file_operations wakelock_window_fops = {
+	.owner = THIS_MODULE,
+	.open = wakelock_window_open,
+	.read = seq_read,
+	.write = wakelock_window_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int wakelock_events_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wakelock_events_show, NULL);
+}
+
+static const struct file_operations wakelock_events_fops = {
+	.owner = THIS_MODULE,
+	.open = wakelock_events_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+#endif
+
 static int __init wakelocks_init(void)
 {
 	int ret;
-	int i;
-
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
-		INIT_LIST_HEAD(&active_wake_locks[i]);
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
@@ -571,6 +863,10 @@ static int __init wakelocks_init(void)
 
 #ifdef CONFIG_WAKELOCK_STAT
 	proc_create("wakelocks", S_IRUGO, NULL, &wakelock_stats_fops);
+	window_start = ktime_get();
+	proc_create("wakelock_window", S_IRUGO | S_IWUSR, NULL,
+		    &wakelock_window_fops);
+	proc_create("wakelock_events", S_IRUGO, NULL, &wakelock_events_fops);
 #endif
 
 	return 0;
@@ -591,6 +887,8 @@ err_platform_device_register:
 static void  __exit wakelocks_exit(void)
 {
 #ifdef CONFIG_WAKELOCK_STAT
+	remove_proc_entry("wakelock_events", NULL);
+	remove_proc_entry("wakelock_window", NULL);
 	remove_proc_entry("wakelocks", NULL);
 #endif
 	destroy_workqueue(suspend_work_queue);
@@ -0,0 +1,170 @@
+/*
+ * wake lock benchmark
+ *
+ * Runs one thread per online cpu, each taking and releasing its own wake
+ * lock in a loop, and reports the average cost of a lock/unlock pair and
+ * of has_wake_lock(). An untimed lock is held for the whole run so that
+ * the benchmark never lets the system suspend.
+ */
+#include <linux/wakelock.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/time.h>
+#include <linux/math64.h>
+
+static unsigned int loops = 1000000;
+module_param(loops, uint, 0644);
+MODULE_PARM_DESC(loops, "lock/unlock pairs per thread");
+
+static unsigned int timeout = 1;
+module_param(timeout, uint, 0644);
+MODULE_PARM_DESC(timeout, "use wake_lock_timeout() instead of wake_lock()");
+
+struct bench_thread {
+	struct wake_lock	lock;
+	char			name[32];
+	struct task_struct	*task;
+	u64			lock_ns;
+	u64			query_ns;
+};
+
+static struct bench_thread *threads;
+static struct wake_lock hold_lock;
+static atomic_t bench_running;
+static DECLARE_COMPLETION(bench_start);
+static DECLARE_COMPLETION(bench_done);
+
+static u64 elapsed_ns(struct timespec *start)
+{
+	struct timespec end;
+
+	getnstimeofday(&end);
+	return timespec_to_ns(&end) - timespec_to_ns(start);
+}
+
+static int wakelock_bench_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	struct timespec start;
+	unsigned int i;
+
+	wait_for_completion(&bench_start);
+
+	getnstimeofday(&start);
+	for (i = 0; i < loops; i++) {
+		if (timeout)
+			wake_lock_timeout(&t->lock, HZ);
+		else
+			wake_lock(&t->lock);
+		wake_unlock(&t->lock);
+	}
+	t->lock_ns = elapsed_ns(&start);
+
+	getnstimeofday(&start);
+	for (i = 0; i < loops; i++)
+		has_wake_lock(WAKE_LOCK_SUSPEND);
+	t->query_ns = elapsed_ns(&start);
+
+	if (atomic_dec_and_test(&bench_running))
+		complete(&bench_done);
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+static void wakelock_bench_stop(int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		kthread_stop(threads[i].task);
+		wake_lock_destroy(&threads[i].lock);
+	}
+}
+
+static int __init wakelock_bench_init(void)
+{
+	u64 lock_ns = 0, query_ns = 0;
+	int nr = 0, cpu;
+	int ret;
+
+	if (!loops)
+		return -EINVAL;
+
+	get_online_cpus();
+	threads = kcalloc(num_online_cpus(), sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		put_online_cpus();
+		return -ENOMEM;
+	}
+
+	wake_lock_init(&hold_lock, WAKE_LOCK_SUSPEND, "wakelock_bench");
+	wake_lock(&hold_lock);
+
+	for_each_online_cpu(cpu) {
+		struct bench_thread *t = &threads[nr];
+
+		snprintf(t->name, sizeof(t->name), "wakelock_bench/%d", cpu);
+		wake_lock_init(&t->lock, WAKE_LOCK_SUSPEND, t->name);
+		t->task = kthread_create(wakelock_bench_thread, t, t->name);
+		if (IS_ERR(t->task)) {
+			ret = PTR_ERR(t->task);
+			wake_lock_destroy(&t->lock);
+			put_online_cpus();
+			goto err_stop;
+		}
+		kthread_bind(t->task, cpu);
+		nr++;
+	}
+	put_online_cpus();
+
+	atomic_set(&bench_running, nr);
+	for (cpu = 0; cpu < nr; cpu++)
+		wake_up_process(threads[cpu].task);
+	complete_all(&bench_start);
+	wait_for_completion(&bench_done);
+
+	for (cpu = 0; cpu < nr; cpu++) {
+		lock_ns += threads[cpu].lock_ns;
+		query_ns += threads[cpu].query_ns;
+	}
+	lock_ns = div64_u64(lock_ns, (u64)nr * loops);
+	query_ns = div64_u64(query_ns, (u64)nr * loops);
+	pr_info("wakelock_bench: %d threads, %u loops, %s: "
+		"%llu ns/lock+unlock, %llu ns/has_wake_lock\n",
+		nr, loops, timeout ? "timeout" : "untimed",
+		(unsigned long long)lock_ns, (unsigned long long)query_ns);
+
+	wakelock_bench_stop(nr);
+	wake_unlock(&hold_lock);
+	return 0;
+
+err_stop:
+	/* threads that were created never got past bench_start */
+	complete_all(&bench_start);
+	wakelock_bench_stop(nr);
+	wake_unlock(&hold_lock);
+	wake_lock_destroy(&hold_lock);
+	kfree(threads);
+	return ret;
+}
+
+static void __exit wakelock_bench_exit(void)
+{
+	wake_lock_destroy(&hold_lock);
+	kfree(threads);
+}
+
+module_init(wakelock_bench_init);
+module_exit(wakelock_bench_exit);
+
+MODULE_DESCRIPTION("wake lock benchmark");
+MODULE_LICENSE("GPL");
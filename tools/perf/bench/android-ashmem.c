@@ -0,0 +1,204 @@
+/*
+ *
+ * android-ashmem.c
+ *
+ * ashmem: Concurrent pin/unpin of ashmem areas
+ *
+ * Every worker process owns an ashmem area and keeps unpinning and pinning
+ * pages of it, the way graphics buffers and cursors are cycled, while all
+ * other workers do the same on their own areas.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include "../../../include/linux/ashmem.h"
+
+#define ASHMEM_DEVICE		"/dev/ashmem"
+
+static unsigned int nr_workers = 4;
+static unsigned int loops = 100000;
+static unsigned int nr_pages = 64;
+
+static const struct option options[] = {
+	OPT_UINTEGER('w', "workers", &nr_workers,
+		     "Specify number of worker processes"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of unpin/pin pairs per worker"),
+	OPT_UINTEGER('p', "pages", &nr_pages,
+		     "Specify size of each area in pages"),
+	OPT_END()
+};
+
+static const char * const bench_android_ashmem_usage[] = {
+	"perf bench android ashmem <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void run_worker(int start_fd, int result_fd)
+{
+	struct timeval start, stop, diff;
+	unsigned long long usec;
+	struct ashmem_pin pin;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t size = nr_pages * page_size;
+	unsigned int i;
+	char *map, dummy;
+	int fd;
+
+	fd = open(ASHMEM_DEVICE, O_RDWR);
+	if (fd < 0)
+		barf("open ashmem");
+	if (ioctl(fd, ASHMEM_SET_SIZE, size) < 0)
+		barf("ASHMEM_SET_SIZE");
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		barf("mmap");
+	memset(map, 0x5a, size);
+
+	/* wait until every worker is ready */
+	if (read(start_fd, &dummy, 1) != 1)
+		barf("read start");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++) {
+		/* cycle through the area, one or two pages at a time */
+		pin.offset = (i % nr_pages) * page_size;
+		pin.len = (i & 1) && pin.offset + page_size < size ?
+			  2 * page_size : page_size;
+
+		if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0)
+			barf("ASHMEM_UNPIN");
+		if (ioctl(fd, ASHMEM_PIN, &pin) < 0)
+			barf("ASHMEM_PIN");
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	munmap(map, size);
+	close(fd);
+
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (write(result_fd, &usec, sizeof(usec)) != sizeof(usec))
+		barf("write result");
+	exit(0);
+}
+
+int bench_android_ashmem(int argc, const char **argv,
+			 const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long usec, max_usec = 0, sum_usec = 0;
+	unsigned long long total_ops;
+	int start_pipe[2], result_pipe[2];
+	int wait_stat;
+	unsigned int i;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_android_ashmem_usage, 0);
+	if (!nr_workers || !loops || !nr_pages) {
+		usage_with_options(bench_android_ashmem_usage, options);
+		return 1;
+	}
+
+	if (access(ASHMEM_DEVICE, R_OK | W_OK)) {
+		fprintf(stderr, "ashmem: %s not available, skipping\n",
+			ASHMEM_DEVICE);
+		return 1;
+	}
+
+	if (pipe(start_pipe) || pipe(result_pipe))
+		barf("pipe()");
+
+	for (i = 0; i < nr_workers; i++) {
+		pid = fork();
+		if (pid < 0)
+			barf("fork()");
+		if (!pid) {
+			close(start_pipe[1]);
+			close(result_pipe[0]);
+			run_worker(start_pipe[0], result_pipe[1]);
+		}
+	}
+	close(start_pipe[0]);
+	close(result_pipe[1]);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_workers; i++) {
+		if (write(start_pipe[1], "", 1) != 1)
+			barf("write start");
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		if (read(result_pipe[0], &usec, sizeof(usec)) != sizeof(usec))
+			barf("read result");
+		sum_usec += usec;
+		if (usec > max_usec)
+			max_usec = usec;
+	}
+	for (i = 0; i < nr_workers; i++) {
+		if (wait(&wait_stat) < 0 || !WIFEXITED(wait_stat) ||
+		    WEXITSTATUS(wait_stat))
+			barf("child failed");
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	total_ops = (unsigned long long)nr_workers * loops;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u workers, %u unpin/pin pairs each on %u page "
+		       "areas\n\n", nr_workers, loops, nr_pages);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/pair\n",
+		       (double)sum_usec / (double)total_ops);
+		printf(" %14llu pairs/sec\n",
+		       max_usec ? total_ops * 1000000ULL / max_usec : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,488 @@
+/*
+ *
+ * android-binder.c
+ *
+ * binder: Lock contention stress for the Android binder driver
+ *
+ * A broker process becomes the binder context manager, each server
+ * registers a node with it and each client looks up its server through
+ * the broker, then all client/server pairs hammer their own node with
+ * synchronous transactions at the same time.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include "../../../drivers/staging/android/binder.h"
+
+#define BINDER_DEVICE		"/dev/binder"
+#define BINDER_MAP_SIZE		(1024 * 1024)
+
+/* transaction codes */
+#define CODE_REGISTER		1
+#define CODE_LOOKUP		2
+#define CODE_PING		3
+#define CODE_QUIT		4
+
+static unsigned int nr_pairs = 8;
+static unsigned int loops = 10000;
+static unsigned int payload = 128;
+
+static const struct option options[] = {
+	OPT_UINTEGER('p', "pairs", &nr_pairs,
+		     "Specify number of client/server pairs"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of transactions per client"),
+	OPT_UINTEGER('s', "size", &payload,
+		     "Specify payload size of a transaction in bytes"),
+	OPT_END()
+};
+
+static const char * const bench_android_binder_usage[] = {
+	"perf bench android binder <options>",
+	NULL
+};
+
+struct binder_conn {
+	int fd;
+	void *map;
+};
+
+/* what the broker and the client lookups put on the wire */
+struct binder_msg {
+	int index;
+	int status;
+	struct flat_binder_object obj;
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void binder_conn_open(struct binder_conn *conn)
+{
+	struct binder_version vers;
+
+	conn->fd = open(BINDER_DEVICE, O_RDWR);
+	if (conn->fd < 0)
+		barf("open " BINDER_DEVICE);
+	if (ioctl(conn->fd, BINDER_VERSION, &vers) < 0)
+		barf("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version %ld, expected %d\n",
+			vers.protocol_version, BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	conn->map = mmap(NULL, BINDER_MAP_SIZE, PROT_READ, MAP_PRIVATE,
+			 conn->fd, 0);
+	if (conn->map == MAP_FAILED)
+		barf("mmap " BINDER_DEVICE);
+}
+
+static void binder_write(struct binder_conn *conn, void *data, size_t size)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = size;
+	bwr.write_buffer = (unsigned long)data;
+	if (ioctl(conn->fd, BINDER_WRITE_READ, &bwr) < 0)
+		barf("BINDER_WRITE_READ write");
+}
+
+/*
+ * Read until a transaction or a reply shows up, acknowledging any
+ * reference count requests for our own node on the way.
+ */
+static uint32_t binder_wait(struct binder_conn *conn,
+			    struct binder_transaction_data *txn)
+{
+	uint32_t rbuf[64];
+	struct binder_write_read bwr;
+	char *ptr, *end;
+	uint32_t cmd;
+
+	for (;;) {
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.read_size = sizeof(rbuf);
+		bwr.read_buffer = (unsigned long)rbuf;
+		if (ioctl(conn->fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			barf("BINDER_WRITE_READ read");
+		}
+
+		ptr = (char *)rbuf;
+		end = ptr + bwr.read_consumed;
+		while (ptr < end) {
+			cmd = *(uint32_t *)ptr;
+			ptr += sizeof(uint32_t);
+
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_INCREFS:
+			case BR_ACQUIRE: {
+				struct {
+					uint32_t cmd;
+					void *ptr;
+					void *cookie;
+				} __attribute__((packed)) done;
+
+				done.cmd = cmd == BR_INCREFS ?
+					BC_INCREFS_DONE : BC_ACQUIRE_DONE;
+				done.ptr = ((void **)ptr)[0];
+				done.cookie = ((void **)ptr)[1];
+				binder_write(conn, &done, sizeof(done));
+				break;
+			}
+			case BR_RELEASE:
+			case BR_DECREFS:
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(txn, ptr, sizeof(*txn));
+				return cmd;
+			default:
+				fprintf(stderr, "binder: unexpected return "
+					"command %08x\n", cmd);
+				exit(1);
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+}
+
+static void binder_free(struct binder_conn *conn, const void *data)
+{
+	struct {
+		uint32_t cmd;
+		const void *buffer;
+	} __attribute__((packed)) cmd;
+
+	cmd.cmd = BC_FREE_BUFFER;
+	cmd.buffer = data;
+	binder_write(conn, &cmd, sizeof(cmd));
+}
+
+static void binder_acquire(struct binder_conn *conn, uint32_t handle)
+{
+	uint32_t cmd[2];
+
+	cmd[0] = BC_ACQUIRE;
+	cmd[1] = handle;
+	binder_write(conn, cmd, sizeof(cmd));
+}
+
+static void binder_fill_txn(struct binder_transaction_data *txn,
+			    uint32_t code, void *data, size_t size,
+			    size_t *offsets, size_t nr_offsets)
+{
+	memset(txn, 0, sizeof(*txn));
+	txn->code = code;
+	txn->data_size = size;
+	txn->data.ptr.buffer = data;
+	txn->offsets_size = nr_offsets * sizeof(size_t);
+	txn->data.ptr.offsets = offsets;
+}
+
+/* Send a two-way transaction and return the reply, which must be freed */
+static void binder_call(struct binder_conn *conn, uint32_t handle,
+			uint32_t code, void *data, size_t size,
+			size_t *offsets, size_t nr_offsets,
+			struct binder_transaction_data *reply)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data txn;
+	} __attribute__((packed)) req;
+	struct binder_transaction_data txn;
+
+	binder_fill_txn(&txn, code, data, size, offsets, nr_offsets);
+	txn.target.handle = handle;
+	req.cmd = BC_TRANSACTION;
+	memcpy(&req.txn, &txn, sizeof(txn));
+	binder_write(conn, &req, sizeof(req));
+
+	if (binder_wait(conn, reply) != BR_REPLY)
+		barf("binder: expected a reply");
+	if (reply->flags & TF_STATUS_CODE)
+		barf("binder: transaction failed");
+}
+
+/* Free the received buffer and send the reply in one go */
+static void binder_reply(struct binder_conn *conn,
+			 struct binder_transaction_data *txn,
+			 void *data, size_t size,
+			 size_t *offsets, size_t nr_offsets)
+{
+	struct {
+		uint32_t cmd_free;
+		const void *buffer;
+		uint32_t cmd_reply;
+		struct binder_transaction_data txn;
+	} __attribute__((packed)) req;
+	struct binder_transaction_data reply;
+
+	binder_fill_txn(&reply, 0, data, size, offsets, nr_offsets);
+	req.cmd_free = BC_FREE_BUFFER;
+	req.buffer = txn->data.ptr.buffer;
+	req.cmd_reply = BC_REPLY;
+	memcpy(&req.txn, &reply, sizeof(reply));
+	binder_write(conn, &req, sizeof(req));
+}
+
+static void run_broker(struct binder_conn *conn)
+{
+	struct binder_transaction_data txn;
+	struct binder_msg *req, msg;
+	uint32_t *handles;
+	size_t offset = offsetof(struct binder_msg, obj);
+	unsigned int registered = 0, served = 0;
+
+	handles = calloc(nr_pairs, sizeof(*handles));
+	if (!handles)
+		barf("calloc");
+
+	while (registered < nr_pairs || served < nr_pairs) {
+		if (binder_wait(conn, &txn) != BR_TRANSACTION)
+			barf("binder: broker expected a transaction");
+		req = (struct binder_msg *)txn.data.ptr.buffer;
+		if (txn.data_size < sizeof(*req) ||
+		    (unsigned int)req->index >= nr_pairs)
+			barf("binder: broker got a bad request");
+
+		memset(&msg, 0, sizeof(msg));
+		msg.index = req->index;
+		switch (txn.code) {
+		case CODE_REGISTER:
+			if (req->obj.type != BINDER_TYPE_HANDLE)
+				barf("binder: server sent no binder");
+			/* keep the ref alive once the buffer is freed */
+			handles[req->index] = req->obj.handle;
+			binder_acquire(conn, req->obj.handle);
+			registered++;
+			binder_reply(conn, &txn, &msg, sizeof(msg), NULL, 0);
+			break;
+		case CODE_LOOKUP:
+			if (!handles[req->index]) {
+				msg.status = -1;
+				binder_reply(conn, &txn, &msg, sizeof(msg),
+					     NULL, 0);
+				break;
+			}
+			msg.obj.type = BINDER_TYPE_HANDLE;
+			msg.obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+			msg.obj.handle = handles[req->index];
+			served++;
+			binder_reply(conn, &txn, &msg, sizeof(msg), &offset, 1);
+			break;
+		default:
+			barf("binder: broker got an unknown code");
+		}
+	}
+	free(handles);
+}
+
+static void run_server(int index)
+{
+	struct binder_conn conn;
+	struct binder_transaction_data txn;
+	struct binder_msg msg;
+	size_t offset = offsetof(struct binder_msg, obj);
+	static int node;
+	uint32_t cmd = BC_ENTER_LOOPER;
+
+	binder_conn_open(&conn);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.index = index;
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	msg.obj.binder = &node;
+	binder_call(&conn, 0, CODE_REGISTER, &msg, sizeof(msg), &offset, 1,
+		    &txn);
+	binder_free(&conn, txn.data.ptr.buffer);
+
+	binder_write(&conn, &cmd, sizeof(cmd));
+	for (;;) {
+		if (binder_wait(&conn, &txn) != BR_TRANSACTION)
+			barf("binder: server expected a transaction");
+		cmd = txn.code;
+		binder_reply(&conn, &txn, NULL, 0, NULL, 0);
+		if (cmd == CODE_QUIT)
+			break;
+	}
+	exit(0);
+}
+
+static void run_client(int index, int result_fd)
+{
+	struct binder_conn conn;
+	struct binder_transaction_data txn;
+	struct binder_msg msg, *rep;
+	struct timeval start, stop, diff;
+	unsigned long long usec;
+	uint32_t handle;
+	unsigned int i;
+	char *data;
+
+	binder_conn_open(&conn);
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.index = index;
+		binder_call(&conn, 0, CODE_LOOKUP, &msg, sizeof(msg), NULL, 0,
+			    &txn);
+		rep = (struct binder_msg *)txn.data.ptr.buffer;
+		if (!rep->status)
+			break;
+		binder_free(&conn, rep);
+		usleep(1000);
+	}
+	handle = rep->obj.handle;
+	binder_acquire(&conn, handle);
+	binder_free(&conn, rep);
+
+	data = zalloc(payload + 1);
+	if (!data)
+		barf("zalloc");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++) {
+		binder_call(&conn, handle, CODE_PING, data, payload, NULL, 0,
+			    &txn);
+		binder_free(&conn, txn.data.ptr.buffer);
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	binder_call(&conn, handle, CODE_QUIT, NULL, 0, NULL, 0, &txn);
+	binder_free(&conn, txn.data.ptr.buffer);
+
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (write(result_fd, &usec, sizeof(usec)) != sizeof(usec))
+		barf("write result");
+	exit(0);
+}
+
+int bench_android_binder(int argc, const char **argv,
+			 const char *prefix __used)
+{
+	struct binder_conn conn;
+	struct timeval start, stop, diff;
+	unsigned long long usec, max_usec = 0, sum_usec = 0;
+	unsigned long long total_ops;
+	int result_pipe[2];
+	int wait_stat;
+	unsigned int i;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_android_binder_usage, 0);
+	if (!nr_pairs || !loops || payload > BINDER_MAP_SIZE / 4) {
+		usage_with_options(bench_android_binder_usage, options);
+		return 1;
+	}
+
+	if (access(BINDER_DEVICE, R_OK | W_OK)) {
+		fprintf(stderr, "binder: %s not available, skipping\n",
+			BINDER_DEVICE);
+		return 1;
+	}
+
+	binder_conn_open(&conn);
+	if (ioctl(conn.fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		barf("BINDER_SET_CONTEXT_MGR (is a service manager running?)");
+	if (pipe(result_pipe))
+		barf("pipe()");
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_pairs * 2; i++) {
+		pid = fork();
+		if (pid < 0)
+			barf("fork()");
+		if (!pid) {
+			/* binder does not copy the mapping across fork */
+			close(conn.fd);
+			close(result_pipe[0]);
+			if (i < nr_pairs)
+				run_server(i);
+			else
+				run_client(i - nr_pairs, result_pipe[1]);
+		}
+	}
+	close(result_pipe[1]);
+
+	run_broker(&conn);
+
+	for (i = 0; i < nr_pairs; i++) {
+		if (read(result_pipe[0], &usec, sizeof(usec)) != sizeof(usec))
+			barf("read result");
+		sum_usec += usec;
+		if (usec > max_usec)
+			max_usec = usec;
+	}
+	for (i = 0; i < nr_pairs * 2; i++) {
+		if (wait(&wait_stat) < 0 || !WIFEXITED(wait_stat) ||
+		    WEXITSTATUS(wait_stat))
+			barf("child failed");
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+	close(conn.fd);
+
+	total_ops = (unsigned long long)nr_pairs * loops;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u client/server pairs, %u transactions of %u bytes"
+		       " each\n\n", nr_pairs, loops, payload);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/transaction\n",
+		       (double)sum_usec / (double)total_ops);
+		printf(" %14llu transactions/sec\n",
+		       max_usec ? total_ops * 1000000ULL / max_usec : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ *
+ * android-logger.c
+ *
+ * logger: Writer throughput of the Android logger driver
+ *
+ * A number of processes write log entries to the same log device at the
+ * same time, the way a busy system hammers /dev/log/main.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#include "../../../drivers/staging/android/logger.h"
+
+#define LOG_PRIO_INFO	4
+
+static const char *device = "/dev/log/main";
+static unsigned int nr_writers = 4;
+static unsigned int loops = 100000;
+static unsigned int msg_size = 64;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "path",
+		   "Specify the log device to write to"),
+	OPT_UINTEGER('w', "writers", &nr_writers,
+		     "Specify number of writer processes"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of entries per writer"),
+	OPT_UINTEGER('s', "size", &msg_size,
+		     "Specify message size of an entry in bytes"),
+	OPT_END()
+};
+
+static const char * const bench_android_logger_usage[] = {
+	"perf bench android logger <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static void run_writer(int start_fd, int result_fd)
+{
+	struct timeval start, stop, diff;
+	unsigned long long usec;
+	unsigned char prio = LOG_PRIO_INFO;
+	char tag[] = "perf-bench";
+	struct iovec vec[3];
+	unsigned int i;
+	char *msg, dummy;
+	int fd;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0)
+		barf("open log device");
+
+	msg = malloc(msg_size + 1);
+	if (!msg)
+		barf("malloc");
+	memset(msg, 'x', msg_size);
+	msg[msg_size] = '\0';
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = tag;
+	vec[1].iov_len = sizeof(tag);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_size + 1;
+
+	/* wait until every writer is ready */
+	if (read(start_fd, &dummy, 1) != 1)
+		barf("read start");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++) {
+		if (writev(fd, vec, 3) < 0)
+			barf("writev");
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	close(fd);
+	free(msg);
+
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (write(result_fd, &usec, sizeof(usec)) != sizeof(usec))
+		barf("write result");
+	exit(0);
+}
+
+int bench_android_logger(int argc, const char **argv,
+			 const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long usec, max_usec = 0, sum_usec = 0;
+	unsigned long long total_ops;
+	int start_pipe[2], result_pipe[2];
+	int wait_stat;
+	unsigned int i;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_android_logger_usage, 0);
+	if (!nr_writers || !loops || msg_size > LOGGER_ENTRY_MAX_PAYLOAD / 2) {
+		usage_with_options(bench_android_logger_usage, options);
+		return 1;
+	}
+
+	if (access(device, W_OK)) {
+		fprintf(stderr, "logger: %s not available, skipping\n",
+			device);
+		return 1;
+	}
+
+	if (pipe(start_pipe) || pipe(result_pipe))
+		barf("pipe()");
+
+	for (i = 0; i < nr_writers; i++) {
+		pid = fork();
+		if (pid < 0)
+			barf("fork()");
+		if (!pid) {
+			close(start_pipe[1]);
+			close(result_pipe[0]);
+			run_writer(start_pipe[0], result_pipe[1]);
+		}
+	}
+	close(start_pipe[0]);
+	close(result_pipe[1]);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_writers; i++) {
+		if (write(start_pipe[1], "", 1) != 1)
+			barf("write start");
+	}
+
+	for (i = 0; i < nr_writers; i++) {
+		if (read(result_pipe[0], &usec, sizeof(usec)) != sizeof(usec))
+			barf("read result");
+		sum_usec += usec;
+		if (usec > max_usec)
+			max_usec = usec;
+	}
+	for (i = 0; i < nr_writers; i++) {
+		if (wait(&wait_stat) < 0 || !WIFEXITED(wait_stat) ||
+		    WEXITSTATUS(wait_stat))
+			barf("child failed");
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	total_ops = (unsigned long long)nr_writers * loops;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u writers, %u entries of %u bytes each to %s\n\n",
+		       nr_writers, loops, msg_size, device);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/entry\n",
+		       (double)sum_usec / (double)total_ops);
+		printf(" %14llu entries/sec\n",
+		       max_usec ? total_ops * 1000000ULL / max_usec : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ *
+ * android-ramzswap.c
+ *
+ * ramzswap: Swap-out throughput of a ramzswap device
+ *
+ * A number of processes write compressible pages straight to their own
+ * part of an initialized but unused ramzswap device, the way several
+ * reclaim contexts swap out at once.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+static const char *device = "/dev/ramzswap0";
+static unsigned int nr_writers = 4;
+static unsigned int nr_pages = 4096;
+static unsigned int loops = 4;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "path",
+		   "Specify the ramzswap device to write to"),
+	OPT_UINTEGER('w', "writers", &nr_writers,
+		     "Specify number of writer processes"),
+	OPT_UINTEGER('p', "pages", &nr_pages,
+		     "Specify number of pages per writer"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of passes over the pages"),
+	OPT_END()
+};
+
+static const char * const bench_android_ramzswap_usage[] = {
+	"perf bench android ramzswap <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+/* roughly 2:1 compressible, and different for every page and pass */
+static void fill_page(unsigned int *buf, size_t page_size, unsigned int seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < page_size / sizeof(*buf); i++)
+		buf[i] = (i & 1) ? seed * 2654435761U + i : i >> 4;
+}
+
+static void run_writer(int index, int start_fd, int result_fd)
+{
+	struct timeval start, stop, diff;
+	unsigned long long usec;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	off_t base = (off_t)(index * nr_pages + 1) * page_size;
+	unsigned int i, pass;
+	void *buf;
+	char dummy;
+	int fd;
+
+	/* O_DIRECT so that every write turns into one swap sized bio */
+	fd = open(device, O_WRONLY | O_DIRECT);
+	if (fd < 0)
+		barf("open ramzswap device");
+
+	if (posix_memalign(&buf, page_size, page_size))
+		barf("posix_memalign");
+
+	/* wait until every writer is ready */
+	if (read(start_fd, &dummy, 1) != 1)
+		barf("read start");
+
+	gettimeofday(&start, NULL);
+	for (pass = 0; pass < loops; pass++) {
+		for (i = 0; i < nr_pages; i++) {
+			fill_page(buf, page_size, pass * nr_pages + i);
+			if (pwrite(fd, buf, page_size,
+				   base + (off_t)i * page_size) !=
+			    (ssize_t)page_size)
+				barf("pwrite");
+		}
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	close(fd);
+	free(buf);
+
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	if (write(result_fd, &usec, sizeof(usec)) != sizeof(usec))
+		barf("write result");
+	exit(0);
+}
+
+int bench_android_ramzswap(int argc, const char **argv,
+			   const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long usec, max_usec = 0, sum_usec = 0;
+	unsigned long long total_ops;
+	int start_pipe[2], result_pipe[2];
+	int wait_stat;
+	unsigned int i;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_android_ramzswap_usage, 0);
+	if (!nr_writers || !nr_pages || !loops) {
+		usage_with_options(bench_android_ramzswap_usage, options);
+		return 1;
+	}
+
+	if (access(device, W_OK)) {
+		fprintf(stderr, "ramzswap: %s not available, skipping\n",
+			device);
+		return 1;
+	}
+
+	if (pipe(start_pipe) || pipe(result_pipe))
+		barf("pipe()");
+
+	for (i = 0; i < nr_writers; i++) {
+		pid = fork();
+		if (pid < 0)
+			barf("fork()");
+		if (!pid) {
+			close(start_pipe[1]);
+			close(result_pipe[0]);
+			run_writer(i, start_pipe[0], result_pipe[1]);
+		}
+	}
+	close(start_pipe[0]);
+	close(result_pipe[1]);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_writers; i++) {
+		if (write(start_pipe[1], "", 1) != 1)
+			barf("write start");
+	}
+
+	for (i = 0; i < nr_writers; i++) {
+		if (read(result_pipe[0], &usec, sizeof(usec)) != sizeof(usec))
+			barf("read result");
+		sum_usec += usec;
+		if (usec > max_usec)
+			max_usec = usec;
+	}
+	for (i = 0; i < nr_writers; i++) {
+		if (wait(&wait_stat) < 0 || !WIFEXITED(wait_stat) ||
+		    WEXITSTATUS(wait_stat))
+			barf("child failed");
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	total_ops = (unsigned long long)nr_writers * nr_pages * loops;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u writers, %u passes over %u pages each to %s\n\n",
+		       nr_writers, loops, nr_pages, device);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/page\n",
+		       (double)sum_usec / (double)total_ops);
+		printf(" %14llu pages/sec\n",
+		       max_usec ? total_ops * 1000000ULL / max_usec : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ *
+ * android-squashfs.c
+ *
+ * squashfs: Cold reads of files on a squashfs file system
+ *
+ * A number of processes read whole files from a read-only image at the
+ * same time, the way applications start from /system. The files are
+ * dropped from the page cache first, so every read decompresses.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+static const char *dir = "/system";
+static unsigned int nr_readers = 4;
+static unsigned int max_files = 256;
+static unsigned int read_kb = 64;
+
+static const struct option options[] = {
+	OPT_STRING('d', "dir", &dir, "path",
+		   "Specify a directory on the squashfs file system"),
+	OPT_UINTEGER('r', "readers", &nr_readers,
+		     "Specify number of reader processes"),
+	OPT_UINTEGER('f', "files", &max_files,
+		     "Specify maximum number of files to read"),
+	OPT_UINTEGER('s', "size", &read_kb,
+		     "Specify size of a read in KB"),
+	OPT_END()
+};
+
+static const char * const bench_android_squashfs_usage[] = {
+	"perf bench android squashfs <options>",
+	NULL
+};
+
+static char **files;
+static unsigned int nr_files;
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+static int add_file(const char *path, const struct stat *st, int type,
+		    struct FTW *ftw __used)
+{
+	if (type != FTW_F || !S_ISREG(st->st_mode) || !st->st_size)
+		return 0;
+
+	files[nr_files] = strdup(path);
+	if (!files[nr_files])
+		barf("strdup");
+	return ++nr_files == max_files;
+}
+
+/* Drop the file from the page cache, so that reading it decompresses */
+static void drop_file(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void run_reader(unsigned int id, int start_fd, int result_fd)
+{
+	unsigned long long bytes = 0;
+	ssize_t ret;
+	unsigned int i;
+	char *buf, dummy;
+	int fd;
+
+	buf = malloc(read_kb * 1024);
+	if (!buf)
+		barf("malloc");
+
+	/* wait until every reader is ready */
+	if (read(start_fd, &dummy, 1) != 1)
+		barf("read start");
+
+	for (i = id; i < nr_files; i += nr_readers) {
+		fd = open(files[i], O_RDONLY);
+		if (fd < 0)
+			continue;
+		while ((ret = read(fd, buf, read_kb * 1024)) > 0)
+			bytes += ret;
+		if (ret < 0)
+			barf("read");
+		close(fd);
+	}
+
+	free(buf);
+
+	if (write(result_fd, &bytes, sizeof(bytes)) != sizeof(bytes))
+		barf("write result");
+	exit(0);
+}
+
+int bench_android_squashfs(int argc, const char **argv,
+			   const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long bytes, total_bytes = 0, usec;
+	int start_pipe[2], result_pipe[2];
+	int wait_stat;
+	unsigned int i;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_android_squashfs_usage, 0);
+	if (!nr_readers || !max_files || !read_kb) {
+		usage_with_options(bench_android_squashfs_usage, options);
+		return 1;
+	}
+
+	if (access(dir, R_OK)) {
+		fprintf(stderr, "squashfs: %s not available, skipping\n", dir);
+		return 1;
+	}
+
+	files = calloc(max_files, sizeof(*files));
+	if (!files)
+		barf("malloc");
+	if (nftw(dir, add_file, 16, FTW_PHYS | FTW_MOUNT) < 0)
+		barf("nftw");
+	if (!nr_files) {
+		fprintf(stderr, "squashfs: no files in %s, skipping\n", dir);
+		return 1;
+	}
+
+	for (i = 0; i < nr_files; i++)
+		drop_file(files[i]);
+
+	if (pipe(start_pipe) || pipe(result_pipe))
+		barf("pipe()");
+
+	for (i = 0; i < nr_readers; i++) {
+		pid = fork();
+		if (pid < 0)
+			barf("fork()");
+		if (!pid) {
+			close(start_pipe[1]);
+			close(result_pipe[0]);
+			run_reader(i, start_pipe[0], result_pipe[1]);
+		}
+	}
+	close(start_pipe[0]);
+	close(result_pipe[1]);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < nr_readers; i++) {
+		if (write(start_pipe[1], "", 1) != 1)
+			barf("write start");
+	}
+
+	for (i = 0; i < nr_readers; i++) {
+		if (read(result_pipe[0], &bytes, sizeof(bytes)) != sizeof(bytes))
+			barf("read result");
+		total_bytes += bytes;
+	}
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	for (i = 0; i < nr_readers; i++) {
+		if (wait(&wait_stat) < 0 || !WIFEXITED(wait_stat) ||
+		    WEXITSTATUS(wait_stat))
+			barf("child failed");
+	}
+
+	for (i = 0; i < nr_files; i++)
+		free(files[i]);
+	free(files);
+
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u readers, %u files, %llu KB from %s\n\n",
+		       nr_readers, nr_files, total_bytes / 1024, dir);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/file\n",
+		       (double)usec / (double)nr_files);
+		printf(" %14lf MB/sec\n",
+		       usec ? (double)total_bytes / (double)usec : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
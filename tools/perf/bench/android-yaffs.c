@@ -0,0 +1,181 @@
+/*
+ *
+ * android-yaffs.c
+ *
+ * yaffs: Small random writes to files on a yaffs2 file system
+ *
+ * Writes of a few bytes at random offsets of a handful of files, the way
+ * databases and settings files are updated on /data. Such writes go
+ * through the yaffs2 short-op chunk cache. Meant to be run on a yaffs2
+ * mount of nandsim, with different cache-size= mount options.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+static const char *dir = "/mnt/yaffs";
+static unsigned int nr_files = 4;
+static unsigned int file_kb = 256;
+static unsigned int write_size = 64;
+static unsigned int loops = 20000;
+
+static const struct option options[] = {
+	OPT_STRING('d', "dir", &dir, "path",
+		   "Specify a directory on the yaffs2 file system"),
+	OPT_UINTEGER('f', "files", &nr_files,
+		     "Specify number of files"),
+	OPT_UINTEGER('k', "kbytes", &file_kb,
+		     "Specify size of each file in KB"),
+	OPT_UINTEGER('s', "size", &write_size,
+		     "Specify size of a write in bytes"),
+	OPT_UINTEGER('l', "loop", &loops,
+		     "Specify number of writes"),
+	OPT_END()
+};
+
+static const char * const bench_android_yaffs_usage[] = {
+	"perf bench android yaffs <options>",
+	NULL
+};
+
+static void barf(const char *msg)
+{
+	fprintf(stderr, "%s (error: %s)\n", msg, strerror(errno));
+	exit(1);
+}
+
+/* same sequence on every run, so that runs can be compared */
+static unsigned int next_rand(unsigned int *seed)
+{
+	*seed = *seed * 1103515245U + 12345U;
+	return *seed >> 8;
+}
+
+static void file_name(char *buf, size_t len, unsigned int i)
+{
+	snprintf(buf, len, "%s/perf-bench-yaffs.%u", dir, i);
+}
+
+static int create_file(unsigned int index, char *buf)
+{
+	char name[PATH_MAX];
+	unsigned int i;
+	int fd;
+
+	file_name(name, sizeof(name), index);
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		barf("create file");
+	memset(buf, 'a' + index % 26, 1024);
+	for (i = 0; i < file_kb; i++) {
+		if (write(fd, buf, 1024) != 1024)
+			barf("write");
+	}
+	if (fsync(fd))
+		barf("fsync");
+	return fd;
+}
+
+int bench_android_yaffs(int argc, const char **argv,
+			const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	unsigned long long usec;
+	unsigned int seed = 1;
+	char name[PATH_MAX];
+	char *buf;
+	int *fds;
+	unsigned int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_android_yaffs_usage, 0);
+	if (!nr_files || !file_kb || !write_size || write_size > 1024 ||
+	    write_size >= file_kb * 1024 || !loops) {
+		usage_with_options(bench_android_yaffs_usage, options);
+		return 1;
+	}
+
+	if (access(dir, W_OK)) {
+		fprintf(stderr, "yaffs: %s not available, skipping\n", dir);
+		return 1;
+	}
+
+	buf = malloc(1024);
+	fds = calloc(nr_files, sizeof(*fds));
+	if (!buf || !fds)
+		barf("malloc");
+
+	for (i = 0; i < nr_files; i++)
+		fds[i] = create_file(i, buf);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < loops; i++) {
+		unsigned int file = next_rand(&seed) % nr_files;
+		off_t offset = next_rand(&seed) %
+			((off_t)file_kb * 1024 - write_size);
+
+		buf[0] = i;
+		if (pwrite(fds[file], buf, write_size, offset) !=
+		    (ssize_t)write_size)
+			barf("pwrite");
+	}
+	for (i = 0; i < nr_files; i++) {
+		if (fsync(fds[i]))
+			barf("fsync");
+	}
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	for (i = 0; i < nr_files; i++) {
+		close(fds[i]);
+		file_name(name, sizeof(name), i);
+		unlink(name);
+	}
+	free(fds);
+	free(buf);
+
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %u writes of %u bytes to %u files of %u KB in %s\n\n",
+		       loops, write_size, nr_files, file_kb, dir);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/write\n",
+		       (double)usec / (double)loops);
+		printf(" %14llu writes/sec\n",
+		       usec ? loops * 1000000ULL / usec : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
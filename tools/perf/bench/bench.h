@@ -4,6 +4,12 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_android_binder(int argc, const char **argv, const char *prefix __used);
+extern int bench_android_logger(int argc, const char **argv, const char *prefix __used);
+extern int bench_android_ashmem(int argc, const char **argv, const char *prefix __used);
+extern int bench_android_ramzswap(int argc, const char **argv, const char *prefix __used);
+extern int bench_android_yaffs(int argc, const char **argv, const char *prefix __used);
+extern int bench_android_squashfs(int argc, const char **argv, const char *prefix __used);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -13,6 +13,7 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  android ... Android staging drivers
  *
  */
 
@@ -58,6 +59,31 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite android_suites[] = {
+	{ "binder",
+	  "Concurrent client/server transactions over binder",
+	  bench_android_binder },
+	{ "logger",
+	  "Concurrent writers to one logger device",
+	  bench_android_logger },
+	{ "ashmem",
+	  "Concurrent pin/unpin of ashmem areas",
+	  bench_android_ashmem },
+	{ "ramzswap",
+	  "Concurrent swap-out to a ramzswap device",
+	  bench_android_ramzswap },
+	{ "yaffs",
+	  "Small random writes to files on yaffs2",
+	  bench_android_yaffs },
+	{ "squashfs",
+	  "Concurrent cold reads of files on squashfs",
+	  bench_android_squashfs },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL                 }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +97,9 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "android",
+	  "Android staging drivers",
+	  android_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },